@@ -23,10 +23,13 @@
 #include "fly_sched.h"
 #include "fly_job.h"
 #include "fly_task.h"
+#include "fly_atomic.h"
 #include "fly_memdebug.h"
 
 #include <stdlib.h>
 
+#define FLY_DEFAULT_IDLE_SPIN_US	50
+
 /* The one and only */
 struct fly_sched fly_sched;
 fly_malloc_func fly_malloc;
@@ -61,17 +64,40 @@ void fly_default_free(void *ptr)
 	free(ptr);
 }
 
-int fly_simple_init(int nbworkers)
+void fly_config_init(struct fly_config *config, int nbworkers)
+{
+	config->nbworkers = nbworkers;
+	config->poll_blocked = 0;
+	config->idle_policy = FLY_IDLE_ADAPTIVE;
+	config->idle_spin_us = FLY_DEFAULT_IDLE_SPIN_US;
+	config->pin_workers = 0;
+	config->numa_nodes = 0;
+	config->prio_aging_us = 0;
+}
+
+int fly_init(const struct fly_config *config)
 {
 	fly_set_malloc(fly_default_malloc);
 	fly_set_free(fly_default_free);
-	fly_set_nbworkers(nbworkers);
+	fly_set_nbworkers(config->nbworkers);
+	fly_sched_set_poll(config->poll_blocked);
+	fly_sched_set_idle(config->idle_policy, config->idle_spin_us);
+	fly_sched_set_pin(config->pin_workers);
+	fly_sched_set_numa(config->numa_nodes);
+	fly_sched_set_prio_aging(config->prio_aging_us);
 
 	fly_init_memdebug();
 
 	return fly_sched_init();
 }
 
+int fly_simple_init(int nbworkers)
+{
+	struct fly_config config;
+	fly_config_init(&config, nbworkers);
+	return fly_init(&config);
+}
+
 int fly_uninit()
 {
 	int err = fly_sched_uninit();
@@ -81,6 +107,45 @@ int fly_uninit()
 	return err;
 }
 
+void fly_get_pool_stats(struct fly_pool_stats *stats)
+{
+	fly_sched_pool_stats(FLY_POOL_JOB, &stats->job_hits, &stats->job_misses);
+	fly_sched_pool_stats(FLY_POOL_TASK, &stats->task_hits, &stats->task_misses);
+}
+
+/******************************************************************************
+ * Blocking regions
+ *****************************************************************************/
+void fly_blocking_begin()
+{
+	fly_sched_blocking_begin();
+}
+
+void fly_blocking_end()
+{
+	fly_sched_blocking_end(fly_sched_get_wthread());
+}
+
+/******************************************************************************
+ * Attached threads
+ *****************************************************************************/
+int fly_attach_thread()
+{
+	return fly_sched_attach();
+}
+
+int fly_detach_thread()
+{
+	return fly_sched_detach();
+}
+
+int fly_run_until(fly_run_until_func cond, void *arg)
+{
+	if (!cond)
+		return FLYEATTR;
+	return fly_sched_run_until(cond, arg);
+}
+
 /******************************************************************************
  * Common helper for adding jobs.
  *****************************************************************************/
@@ -91,6 +156,9 @@ static int fly_add_job_and_wait(struct fly_job *job, int wait)
 	if (wthread) {
 		job->recurse++;
 		err = fly_sched_add_job_from_worker(job, wthread);
+	} else if (wait) {
+		/* the caller runs batches too instead of only sleeping */
+		err = fly_sched_add_job_and_run(job);
 	} else {
 		err = fly_sched_add_job(job);
 	}
@@ -132,44 +200,217 @@ int fly_parallel_for_arr(int start, int end, fly_parallel_for_func func,
 	return err;
 }
 
+int fly_parallel_for_ex(int count, fly_parallel_for_func func, void *ptr,
+		enum fly_pfor_schedule schedule, int grain)
+{
+	int err = FLYENORES;
+	struct fly_job *job = fly_create_job_pfor(count, func, ptr);
+	if (job) {
+		fly_job_set_schedule(job, schedule, grain);
+		err = fly_add_job_and_wait(job, 1);
+		fly_destroy_job(job);
+	}
+	return err;
+}
+
+int fly_parallel_for_arr_ex(int start, int end, fly_parallel_for_func func,
+		void *arr, size_t elsize, enum fly_pfor_schedule schedule, int grain)
+{
+	int err = FLYENORES;
+	struct fly_job *job = fly_create_job_pfarr(start, end, func, arr, elsize);
+	if (job) {
+		fly_job_set_schedule(job, schedule, grain);
+		err = fly_add_job_and_wait(job, 1);
+		fly_destroy_job(job);
+	}
+	return err;
+}
+
+int fly_parallel_for_range(int start, int end, fly_parallel_range_func func,
+		void *ptr)
+{
+	int err = FLYENORES;
+	struct fly_job *job = fly_create_job_prange(start, end, func, ptr);
+	if (job) {
+		err = fly_add_job_and_wait(job, 1);
+		fly_destroy_job(job);
+	}
+	return err;
+}
+
+int fly_parallel_for_range_arr(int start, int end, fly_parallel_range_func func,
+		void *arr, size_t elsize)
+{
+	int err = FLYENORES;
+	struct fly_job *job = fly_create_job_prarr(start, end, func, arr, elsize);
+	if (job) {
+		err = fly_add_job_and_wait(job, 1);
+		fly_destroy_job(job);
+	}
+	return err;
+}
+
 /******************************************************************************
  * Task parallelism
  *****************************************************************************/
 struct fly_task *fly_create_task(fly_task_func func, void *param)
 {
-	struct fly_task *task = fly_malloc(sizeof(struct fly_task));
-	task->func = func;
-	task->param = param;
-	task->sched_data = NULL;
+	struct fly_task *task = fly_sched_pool_get(FLY_POOL_TASK);
+	if (!task)
+		task = fly_malloc(sizeof(struct fly_task));
+	if (task) {
+		task->func = func;
+		task->param = param;
+		task->sched_data = NULL;
+		task->queue = NULL;
+		task->group = NULL;
+	}
 	return task;
 }
 
 void fly_destroy_task(struct fly_task *task)
 {
-	fly_free(task);
+	if (!fly_sched_pool_put(FLY_POOL_TASK, task))
+		fly_free(task);
+}
+
+int fly_create_tasks(struct fly_task **tasks, fly_task_func func,
+		void *params, size_t elsize, int nbtasks)
+{
+	int i;
+	for (i = 0; i < nbtasks; i++) {
+		tasks[i] = fly_create_task(func, (char*)params + (i * elsize));
+		if (!tasks[i]) {
+			fly_destroy_tasks(tasks, i);
+			return FLYENORES;
+		}
+	}
+	return FLYESUCCESS;
+}
+
+void fly_destroy_tasks(struct fly_task **tasks, int nbtasks)
+{
+	int i;
+	for (i = 0; i < nbtasks; i++)
+		fly_destroy_task(tasks[i]);
+}
+
+/* a queue counts its tasks from the push - nb is 1 or -1 if it failed */
+static inline void fly_task_queued(struct fly_task *task, int nb)
+{
+	if (task->queue)
+		fly_atomic_inc(&task->queue->pending, nb);
 }
 
 int fly_push_task(struct fly_task *task)
+{
+	return fly_push_task_prio(task, FLY_PRIO_NORMAL);
+}
+
+/* all jobs are made before any is added - no task is pushed if one fails */
+int fly_push_tasks(struct fly_task **tasks, int nbtasks)
+{
+	struct fly_job *job;
+	int i;
+	for (i = 0; i < nbtasks; i++) {
+		job = fly_create_job_task(tasks[i]);
+		if (!job) {
+			while (i-- > 0) {
+				fly_destroy_job(tasks[i]->sched_data);
+				tasks[i]->sched_data = NULL;
+			}
+			return FLYENORES;
+		}
+		tasks[i]->sched_data = job;
+	}
+	for (i = 0; i < nbtasks; i++)
+		fly_task_queued(tasks[i], 1);
+	return fly_sched_add_tasks(tasks, nbtasks);
+}
+
+int fly_push_task_prio(struct fly_task *task, enum fly_task_prio prio)
 {
 	int err = FLYENORES;
-	struct fly_job *job = fly_create_job_task(task);
+	struct fly_job *job;
+	if ((prio < 0) || (prio >= FLY_PRIO_NB_LEVELS))
+		return FLYEATTR;
+	job = fly_create_job_task(task);
 	if (job) {
+		job->prio = prio;
 		task->sched_data = job;
-		err = fly_add_job_and_wait(job, 0);
-		if (!FLY_SUCCEEDED(err))
+		fly_task_queued(task, 1);
+		/* the deques of the workers know no priorities */
+		if (prio == FLY_PRIO_NORMAL)
+			err = fly_add_job_and_wait(job, 0);
+		else
+			err = fly_sched_add_job(job);
+		if (!FLY_SUCCEEDED(err)) {
+			fly_task_queued(task, -1);
+			fly_destroy_job(job);
+		}
+	}
+	return err;
+}
+
+/*
+ * deps holds the task back until the edges are all added, so a dependency
+ * which completes meanwhile cannot start it early.
+ */
+int fly_push_task_after(struct fly_task *task, struct fly_task **deps,
+		int nbdeps)
+{
+	int err = FLYENORES;
+	struct fly_job *job;
+	int i;
+	/* the job of a grouped task may be recycled as soon as it completes */
+	for (i = 0; i < nbdeps; i++) {
+		if (deps[i]->group)
+			return FLYEATTR;
+	}
+	job = fly_create_job_task(task);
+	if (!job)
+		return err;
+	if (nbdeps > 0) {
+		job->edges = fly_malloc(nbdeps * sizeof(struct fly_job_edge));
+		if (!job->edges) {
 			fly_destroy_job(job);
+			return err;
+		}
+	}
+	task->sched_data = job;
+	fly_task_queued(task, 1);
+	job->deps = nbdeps + 1;
+	for (i = 0; i < nbdeps; i++) {
+		struct fly_job *pred = deps[i]->sched_data;
+		if (!pred || !fly_job_add_succ(pred, &job->edges[i], job))
+			fly_atomic_dec(&job->deps, 1);
+	}
+	if (fly_atomic_dec(&job->deps, 1) > 0)
+		return FLYESUCCESS;
+	err = fly_add_job_and_wait(job, 0);
+	if (!FLY_SUCCEEDED(err)) {
+		fly_task_queued(task, -1);
+		task->sched_data = NULL;
+		fly_destroy_job(job);
 	}
 	return err;
 }
 
+int fly_task_then(struct fly_task *pred, struct fly_task *succ)
+{
+	return fly_push_task_after(succ, &pred, 1);
+}
+
 int fly_wait_task(struct fly_task *task)
 {
 	int err = FLYEATTR;
 	if (task->sched_data) {
 		struct fly_job *job = task->sched_data;
 		err = fly_wait_job(job);
-		if (FLY_SUCCEEDED(err))
+		if (FLY_SUCCEEDED(err)) {
 			fly_destroy_job(job);
+			task->sched_data = NULL;
+		}
 	}
 	return err;
 }
@@ -186,6 +427,191 @@ int fly_wait_tasks(struct fly_task **tasks, int nbtasks)
 	return err;
 }
 
+/* tasks which are not pushed or already waited for are done */
+int fly_task_is_done(struct fly_task *task)
+{
+	if (!task->sched_data)
+		return 1;
+	return fly_job_is_done(task->sched_data);
+}
+
+/* the pushed tasks which are not waited for yet are candidates */
+int fly_wait_any(struct fly_task **tasks, int nbtasks, int *index)
+{
+	for (;;) {
+		int seen = fly_sched_get_completions();
+		int outstanding = 0;
+		int i;
+		for (i = 0; i < nbtasks; i++) {
+			if (!tasks[i]->sched_data)
+				continue;
+			outstanding = 1;
+			if (fly_job_is_done(tasks[i]->sched_data)) {
+				*index = i;
+				return fly_wait_task(tasks[i]);
+			}
+		}
+		if (!outstanding)
+			return FLYEATTR;
+		fly_sched_wait_completion(seen);
+	}
+}
+
+/******************************************************************************
+ * Completion queues
+ *****************************************************************************/
+struct fly_task_queue *fly_create_task_queue()
+{
+	struct fly_task_queue *queue = fly_malloc(sizeof(struct fly_task_queue));
+	if (queue) {
+		queue->head = NULL;
+		queue->ready = NULL;
+		queue->pending = 0;
+		if (fly_sem_init(&queue->sem) != 0) {
+			fly_free(queue);
+			queue = NULL;
+		}
+	}
+	return queue;
+}
+
+void fly_destroy_task_queue(struct fly_task_queue *queue)
+{
+	fly_sem_uninit(&queue->sem);
+	fly_free(queue);
+}
+
+void fly_task_set_queue(struct fly_task *task, struct fly_task_queue *queue)
+{
+	task->queue = queue;
+}
+
+/* the task is waited for already - it can be destroyed or pushed again */
+static struct fly_task *fly_task_queue_take(struct fly_task_queue *queue)
+{
+	struct fly_job *job = fly_job_queue_pop(queue);
+	struct fly_task *task = job->data;
+	fly_atomic_dec(&queue->pending, 1);
+	fly_wait_task(task);
+	return task;
+}
+
+struct fly_task *fly_task_queue_poll(struct fly_task_queue *queue)
+{
+	if (fly_sem_trywait(&queue->sem) != 0)
+		return NULL;
+	return fly_task_queue_take(queue);
+}
+
+struct fly_task *fly_task_queue_wait(struct fly_task_queue *queue)
+{
+	struct fly_worker_thread *wthread;
+	if (fly_sem_trywait(&queue->sem) != 0) {
+		if (queue->pending == 0)
+			return NULL;
+		wthread = fly_sched_blocking_begin();
+		fly_sem_notrack_wait(&queue->sem);
+		fly_sched_blocking_end(wthread);
+	}
+	return fly_task_queue_take(queue);
+}
+
+/******************************************************************************
+ * Task groups
+ *****************************************************************************/
+struct fly_task_group *fly_create_task_group()
+{
+	struct fly_task_group *group = fly_malloc(sizeof(struct fly_task_group));
+	if (group) {
+		group->pending = 0;
+		group->nbwaiting = 0;
+		group->cancelled = 0;
+		group->users = 0;
+	}
+	return group;
+}
+
+/* the last worker may still be waking the waiters */
+void fly_destroy_task_group(struct fly_task_group *group)
+{
+	while (group->users > 0)
+		fly_thread_yield();
+	fly_free(group);
+}
+
+/* nothing may hold the job of a grouped task - it has no queue */
+int fly_group_push_task(struct fly_task_group *group, struct fly_task *task)
+{
+	int err = FLYENORES;
+	struct fly_job *job;
+	if (task->queue)
+		return FLYEATTR;
+	job = fly_create_job_task(task);
+	if (job) {
+		job->group = group;
+		task->group = group;
+		task->sched_data = job;
+		fly_atomic_inc(&group->pending, 1);
+		err = fly_add_job_and_wait(job, 0);
+		if (!FLY_SUCCEEDED(err)) {
+			fly_atomic_dec(&group->pending, 1);
+			task->sched_data = NULL;
+			fly_destroy_job(job);
+		}
+	}
+	return err;
+}
+
+int fly_group_timed_wait(struct fly_task_group *group, long usec)
+{
+	struct fly_worker_thread *wthread;
+	long long end = fly_thread_time_usec() + usec;
+	long long left = usec;
+	int err = FLYESUCCESS;
+	int pending;
+	if (group->pending == 0)
+		return FLYESUCCESS;
+	/* like fly_wait_job, a worker without a deadline runs other jobs first */
+	wthread = fly_sched_get_wthread();
+	if (wthread && (usec < 0)) {
+		while ((group->pending > 0) && fly_sched_help(wthread))
+			;
+	}
+	wthread = fly_sched_blocking_begin();
+	/* see fly_job_group_done - it wakes only when nbwaiting is raised */
+	fly_atomic_inc(&group->nbwaiting, 1);
+	while ((pending = group->pending) > 0) {
+		if (usec < 0) {
+			fly_futex_wait(&group->pending, pending);
+			continue;
+		}
+		if (left <= 0) {
+			err = FLYETIMEDOUT;
+			break;
+		}
+		fly_futex_timed_wait(&group->pending, pending, left);
+		left = end - fly_thread_time_usec();
+	}
+	fly_atomic_dec(&group->nbwaiting, 1);
+	fly_sched_blocking_end(wthread);
+	return err;
+}
+
+int fly_group_wait(struct fly_task_group *group)
+{
+	return fly_group_timed_wait(group, -1);
+}
+
+void fly_group_cancel(struct fly_task_group *group)
+{
+	group->cancelled = 1;
+}
+
+int fly_group_is_cancelled(struct fly_task_group *group)
+{
+	return group->cancelled;
+}
+
 void *fly_get_task_result(struct fly_task *task)
 {
 	return task->result;
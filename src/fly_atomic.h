@@ -26,7 +26,7 @@
 	__sync_add_and_fetch(ptr, val)
 
 #define fly_atomic_dec(ptr, val) \
-	__sync_sub_and_fetch(ptr, val);
+	__sync_sub_and_fetch(ptr, val)
 
 #define fly_atomic_cas(ptr, desired, val) \
 	__sync_bool_compare_and_swap(ptr, desired, val)
@@ -34,4 +34,23 @@
 #define fly_atomic_and(ptr, val) \
 	__sync_and_and_fetch(ptr, val)
 
+/* the two below return the old value */
+#define fly_atomic_fetch_or(ptr, val) \
+	__sync_fetch_and_or(ptr, val)
+
+#define fly_atomic_fetch_and(ptr, val) \
+	__sync_fetch_and_and(ptr, val)
+
+#define fly_atomic_barrier() \
+	__sync_synchronize()
+
+/* hint for the CPU inside of spin loops */
+#if defined(__i386__) || defined(__x86_64__)
+#define fly_cpu_relax() \
+	__builtin_ia32_pause()
+#else
+#define fly_cpu_relax() \
+	__asm__ __volatile__("" ::: "memory")
+#endif
+
 #endif /* LIBFLY_FLY_ATOMIC_H */
@@ -0,0 +1,160 @@
+/******************************************************************************
+ * fly_deque.h
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+/*
+ * Work stealing deque(Chase-Lev).
+ * Only the owner thread may push and pop from the bottom of the deque, any
+ * other thread may steal from the top. When the deque grows the old arrays are
+ * kept, since a thief may still read from them, and are released together
+ * with the deque.
+ */
+
+#ifndef LIBFLY_FLY_DEQUE_H
+#define LIBFLY_FLY_DEQUE_H
+
+#include <libfly/fly_error.h>
+#include "fly_globals.h"
+#include "fly_atomic.h"
+
+#define FLY_DEQUE_DEFAULT_SIZE	64
+
+struct fly_deque_array {
+	struct fly_deque_array	*prev;
+	long					size;
+	void					*els[];
+}; /* struct fly_deque_array */
+
+struct fly_deque {
+	volatile long					top;
+	volatile long					bottom;
+	struct fly_deque_array *volatile	arr;
+}; /* struct fly_deque */
+
+static inline struct fly_deque_array *fly_deque_array_create(long size)
+{
+	struct fly_deque_array *arr;
+	arr = fly_malloc(sizeof(struct fly_deque_array) + (size * sizeof(void*)));
+	if (arr) {
+		arr->prev = NULL;
+		arr->size = size;
+	}
+	return arr;
+}
+
+static inline int fly_deque_init(struct fly_deque *deque, long size)
+{
+	deque->top = 0;
+	deque->bottom = 0;
+	deque->arr = fly_deque_array_create(size);
+	if (!deque->arr)
+		return FLYENORES;
+	return FLYESUCCESS;
+}
+
+static inline void fly_deque_uninit(struct fly_deque *deque)
+{
+	struct fly_deque_array *arr = deque->arr;
+	while (arr) {
+		struct fly_deque_array *prev = arr->prev;
+		fly_free(arr);
+		arr = prev;
+	}
+	deque->arr = NULL;
+}
+
+static inline int fly_deque_is_empty(struct fly_deque *deque)
+{
+	return deque->bottom <= deque->top;
+}
+
+static inline struct fly_deque_array *fly_deque_grow(struct fly_deque *deque,
+		long top, long bottom)
+{
+	struct fly_deque_array *old = deque->arr;
+	struct fly_deque_array *arr = fly_deque_array_create(old->size * 2);
+	if (arr) {
+		long i;
+		for (i = top; i < bottom; i++)
+			arr->els[i % arr->size] = old->els[i % old->size];
+		arr->prev = old;
+		fly_atomic_barrier();
+		deque->arr = arr;
+	}
+	return arr;
+}
+
+/* owner only */
+static inline int fly_deque_push(struct fly_deque *deque, void *el)
+{
+	long bottom = deque->bottom;
+	long top = deque->top;
+	struct fly_deque_array *arr = deque->arr;
+	if ((bottom - top) >= arr->size) {
+		arr = fly_deque_grow(deque, top, bottom);
+		if (!arr)
+			return FLYENORES;
+	}
+	arr->els[bottom % arr->size] = el;
+	fly_atomic_barrier();
+	deque->bottom = bottom + 1;
+	return FLYESUCCESS;
+}
+
+/* owner only */
+static inline void *fly_deque_pop(struct fly_deque *deque)
+{
+	void *el = NULL;
+	long bottom = deque->bottom - 1;
+	long top;
+	struct fly_deque_array *arr = deque->arr;
+	deque->bottom = bottom;
+	fly_atomic_barrier();
+	top = deque->top;
+	if (top <= bottom) {
+		el = arr->els[bottom % arr->size];
+		if (top == bottom) {
+			/* last element - race with the thieves for it */
+			if (!fly_atomic_cas(&deque->top, top, top + 1))
+				el = NULL;
+			deque->bottom = bottom + 1;
+		}
+	} else {
+		deque->bottom = bottom + 1;
+	}
+	return el;
+}
+
+static inline void *fly_deque_steal(struct fly_deque *deque)
+{
+	long top = deque->top;
+	long bottom;
+	fly_atomic_barrier();
+	bottom = deque->bottom;
+	if (top < bottom) {
+		struct fly_deque_array *arr = deque->arr;
+		void *el = arr->els[top % arr->size];
+		if (fly_atomic_cas(&deque->top, top, top + 1))
+			return el;
+	}
+	return NULL;
+}
+
+#endif /* LIBFLY_FLY_DEQUE_H */
@@ -24,6 +24,8 @@
 
 #include <libfly/fly.h>
 
+#define FLY_CACHE_LINE_SIZE	64
+
 extern struct fly_sched fly_sched;
 
 extern fly_malloc_func fly_malloc;
@@ -25,35 +25,35 @@
 #include "fly_task.h"
 #include "fly_atomic.h"
 
+#include <limits.h> /* for INT_MAX */
+
 /******************************************************************************
  * Helper functions declarations.
  *****************************************************************************/
-static struct fly_job_batch *job_make_batch(struct fly_job *job,
+static struct fly_job *job_alloc();
+static void job_init_common(struct fly_job *job, int jtype, void *data,
+		int start, int end);
+static int job_alloc_batches(struct fly_job *job, int nbbatches);
+static void job_init_batch(struct fly_job_batch *batch, struct fly_job *job,
 		int start, int end);
-static void job_destroy_batch(struct fly_job_batch *batch);
-static int job_add_batch(struct fly_job *job, struct fly_job_batch *batch);
-static void job_remove_batch(struct fly_job *job, struct fly_job_batch *batch);
+static int job_make_splits(struct fly_job *job, int nbparts);
+static int job_claim_split(struct fly_job *job, struct fly_job_split **split,
+		int *start, int *end);
+static int job_splits_have_work(struct fly_job *job);
+static int job_make_nodes(struct fly_job *job);
+static struct fly_job_batch *job_claim_node_batch(struct fly_job *job,
+		int node);
+static int job_nodes_have_work(struct fly_job *job);
 
 struct fly_job *fly_create_job_pfor(int count, fly_parallel_for_func func,
 		void *ptr)
 {
-	struct fly_job *job = fly_malloc(sizeof(struct fly_job));
+	struct fly_job *job = NULL;
+	if (count > 0)
+		job = job_alloc();
 	if (job) {
-		if (fly_sem_init(&job->sem) == 0) {
-			job->data = ptr;
-			job->start = 0;
-			job->end = count;
-			job->state = FLY_JOB_IDLE;
-			fly_list_init(&job->batches);
-			job->nbbatches = 0;
-			job->batches_done = 0;
-			job->func.pfor = func;
-			job->jtype = FLY_TASK_PARALLEL_FOR;
-			job->recurse = 0;
-		} else {
-			fly_free(job);
-			job = NULL;
-		}
+		job_init_common(job, FLY_TASK_PARALLEL_FOR, ptr, 0, count);
+		job->func.pfor = func;
 	}
 	return job;
 }
@@ -62,47 +62,49 @@ struct fly_job *fly_create_job_pfarr(int start, int end,
 		fly_parallel_for_func func, void *data, size_t elsize)
 {
 	struct fly_job *job = NULL;
-	if ((end - start) > 0) {
-		job = fly_malloc(sizeof(struct fly_job));
-		if (job) {
-			if (fly_sem_init(&job->sem) == 0) {
-				job->data = data;
-				job->elsize = elsize;
-				job->start = start;
-				job->end = end;
-				job->state = FLY_JOB_IDLE;
-				fly_list_init(&job->batches);
-				job->nbbatches = 0;
-				job->batches_done = 0;
-				job->func.pfor = func;
-				job->jtype = FLY_TASK_PARALLEL_FOR_ARR;
-				job->recurse = 0;
-			} else {
-				fly_free(job);
-				job = NULL;
-			}
-		}
+	if ((end - start) > 0)
+		job = job_alloc();
+	if (job) {
+		job_init_common(job, FLY_TASK_PARALLEL_FOR_ARR, data, start, end);
+		job->elsize = elsize;
+		job->func.pfor = func;
+	}
+	return job;
+}
+
+struct fly_job *fly_create_job_prange(int start, int end,
+		fly_parallel_range_func func, void *ptr)
+{
+	struct fly_job *job = fly_create_job_prarr(start, end, func, ptr, 0);
+	if (job)
+		job->jtype = FLY_TASK_PARALLEL_RANGE;
+	return job;
+}
+
+struct fly_job *fly_create_job_prarr(int start, int end,
+		fly_parallel_range_func func, void *data, size_t elsize)
+{
+	struct fly_job *job = NULL;
+	if ((end - start) > 0)
+		job = job_alloc();
+	if (job) {
+		job_init_common(job, FLY_TASK_PARALLEL_RANGE_ARR, data, start, end);
+		job->elsize = elsize;
+		job->func.prange = func;
 	}
 	return job;
 }
 
 struct fly_job *fly_create_job_task(struct fly_task *task)
 {
-	struct fly_job *job = fly_malloc(sizeof(struct fly_job));
+	struct fly_job *job = job_alloc();
 	if (job) {
-		if (fly_sem_init(&job->sem) == 0) {
-			job->data = task;
-			job->state = FLY_JOB_IDLE;
-			fly_list_init(&job->batches);
-			job->func.tfunc = task->func;
-			job->nbbatches = 1;
-			job->batches_done = 0;
-			job->jtype = FLY_TASK_TASK;
-			job->recurse = 0;
-		} else {
-			fly_free(job);
-			job = NULL;
-		}
+		job_init_common(job, FLY_TASK_TASK, task, 0, 0);
+		job->func.tfunc = task->func;
+		job->nbbatches = 1;
+		job->queue = task->queue;
+		/* pushed again it leaves its group, fly_group_push_task sets it */
+		task->group = NULL;
 	}
 	return job;
 }
@@ -110,25 +112,47 @@ struct fly_job *fly_create_job_task(struct fly_task *task)
 void fly_destroy_job(struct fly_job *job)
 {
 	if (job) {
-		while (!fly_list_is_empty(&job->batches)) {
-			struct fly_list *node = fly_list_tail(&job->batches);
-			void *batch = node->el;
-			job_remove_batch(job, batch);
-			job_destroy_batch(batch);
+		fly_destroy_batches(job);
+		if (job->edges) {
+			fly_free(job->edges);
+			job->edges = NULL;
 		}
-		fly_sem_uninit(&job->sem);
-		fly_free(job);
+		/* a job destroyed without waiting may still have its post */
+		while (fly_sem_trywait(&job->sem) == 0)
+			;
+		if (!fly_sched_pool_put(FLY_POOL_JOB, job))
+			fly_job_release(job);
 	}
 }
 
+void fly_job_release(void *job)
+{
+	fly_sem_uninit(&((struct fly_job*)job)->sem);
+	fly_free(job);
+}
+
 int fly_wait_job(struct fly_job *job)
 {
+	struct fly_worker_thread *wthread = fly_sched_get_wthread();
+	int err;
 	fly_assert(job, "fly_job_wait NULL job");
 	/*
-	 * TODO:
-	 * Add variant to know if we wait from fly_thread so it could be tracked.
+	 * A worker runs other jobs while it waits, the job may be one of them.
+	 * Once there is nothing to run it blocks and lets its backup thread run.
 	 */
-	if (fly_sem_notrack_wait(&job->sem) == 0) {
+	if (wthread) {
+		while (!fly_job_is_done(job) && fly_sched_help(wthread))
+			;
+	}
+	wthread = NULL;
+	if (!fly_job_is_done(job))
+		wthread = fly_sched_blocking_begin();
+	err = fly_sem_notrack_wait(&job->sem);
+	fly_sched_blocking_end(wthread);
+	if (err == 0) {
+		/* threads which still hold the job find out it is done or post */
+		while (job->users > 0)
+			fly_thread_yield();
 		fly_sched_job_collected(job);
 		return FLYESUCCESS;
 	}
@@ -145,98 +169,584 @@ int fly_job_is_done(struct fly_job *job)
 int fly_make_batches(struct fly_job *job, int nbbatches)
 {
 	int funcscount = job->end - job->start;
-	int batchsize = funcscount / nbbatches;
+	int batchsize;
+	int start = job->start;
 	int i;
 
 	job->state = FLY_JOB_PREPARING;
-	if (batchsize == 0)
-		batchsize++;
-	for (i = 0; i < nbbatches; i++) {
-		int start = job->start + (i * batchsize);
-		int end = start + batchsize;
-		struct fly_job_batch *batch = job_make_batch(job, start, end);
-		if (batch) {
-			int err = job_add_batch(job, batch);
-			if (!FLY_SUCCEEDED(err)) {
-				job_destroy_batch(batch);
-				break;
-			}
-		} else {
-			break;
+	if (job->schedule == FLY_PFOR_ADAPTIVE) {
+		if (!FLY_SUCCEEDED(job_make_splits(job, nbbatches))) {
+			job->state = FLY_JOB_IDLE;
+			return FLYENORES;
 		}
+		job->nbbatches = funcscount;
+		job->state = FLY_JOB_READY;
+		return FLYESUCCESS;
 	}
-	if (i != nbbatches) {
-		while (!fly_list_is_empty(&job->batches)) {
-			struct fly_list *node = fly_list_tail(&job->batches);
-			void *batch = node->el;
-			job_remove_batch(job, batch);
-			job_destroy_batch(batch);
-		}
+	if ((job->schedule != FLY_PFOR_STATIC) &&
+			(job->schedule != FLY_PFOR_NODE)) {
+		/* no batches - iterations are taken from the cursor */
+		job->cursor = job->start;
+		job->nbparts = nbbatches;
+		job->nbbatches = funcscount;
+		job->state = FLY_JOB_READY;
+		return FLYESUCCESS;
+	}
+	if (job->grain > 0)
+		nbbatches = (funcscount + job->grain - 1) / job->grain;
+	if (nbbatches > funcscount)
+		nbbatches = funcscount;
+	if (!FLY_SUCCEEDED(job_alloc_batches(job, nbbatches))) {
 		job->state = FLY_JOB_IDLE;
 		return FLYENORES;
 	}
-	if ((funcscount > nbbatches) && (funcscount % nbbatches) != 0) {
-		struct fly_list *node = fly_list_tail(&job->batches);
-		struct fly_job_batch *batch = node->el;
-		batch->end += funcscount % nbbatches;
+	batchsize = funcscount / nbbatches;
+	for (i = 0; i < nbbatches; i++) {
+		/* spread the remainder over the first batches */
+		int end = start + batchsize + ((i < (funcscount % nbbatches)) ? 1 : 0);
+		job_init_batch(&job->batches[i], job, start, end);
+		start = end;
 	}
+	job->next_batch = 0;
 	job->nbbatches = nbbatches;
+	if ((job->schedule == FLY_PFOR_NODE) &&
+			!FLY_SUCCEEDED(job_make_nodes(job))) {
+		fly_destroy_batches(job);
+		job->state = FLY_JOB_IDLE;
+		return FLYENORES;
+	}
 	job->state = FLY_JOB_READY;
 	return FLYESUCCESS;
 }
 
+/* how many threads could work on the job at once, tasks have one batch */
+int fly_job_parallelism(struct fly_job *job)
+{
+	int grain = (job->grain > 0) ? job->grain : 1;
+	if ((job->schedule == FLY_PFOR_STATIC) || (job->schedule == FLY_PFOR_NODE))
+		return job->nbbatches;
+	return (job->end - job->start + grain - 1) / grain;
+}
+
 void fly_destroy_batches(struct fly_job *job)
 {
 	if (job) {
-		while (!fly_list_is_empty(&job->batches)) {
-			struct fly_list *node = fly_list_tail(&job->batches);
-			void *batch = node->el;
-			job_remove_batch(job, batch);
-			job_destroy_batch(batch);
+		if (job->batches) {
+			fly_free(job->batches);
+			job->batches = NULL;
+		}
+		if (job->splits) {
+			fly_free(job->splits);
+			job->splits = NULL;
+		}
+		if (job->nodes) {
+			fly_free(job->nodes);
+			job->nodes = NULL;
 		}
 	}
 }
 
 struct fly_job_batch *fly_get_exec_batch(struct fly_job *job)
 {
-	struct fly_list *curr = fly_list_head(&job->batches);
-	while (curr && curr->el) {
-		struct fly_job_batch *batch = curr->el;
-		if (fly_atomic_cas(&batch->execed, 0, 1))
-			return batch;
-		else
-			curr = curr->next;
+	int ind;
+	if (job->next_batch >= job->nbbatches)
+		return NULL;
+	ind = fly_atomic_inc(&job->next_batch, 1) - 1;
+	if (ind >= job->nbbatches)
+		return NULL;
+	return &job->batches[ind];
+}
+
+void fly_job_set_schedule(struct fly_job *job,
+		enum fly_pfor_schedule schedule, int grain)
+{
+	job->schedule = schedule;
+	job->grain = grain;
+}
+
+/* node is the NUMA node group of the calling worker */
+int fly_job_claim_range(struct fly_job *job, int node,
+		struct fly_job_split **split, int *start, int *end)
+{
+	int grain = (job->grain > 0) ? job->grain : 1;
+	int curr;
+	int chunk;
+
+	switch (job->schedule) {
+	case FLY_PFOR_ADAPTIVE:
+		return job_claim_split(job, split, start, end);
+	case FLY_PFOR_DYNAMIC:
+		if (job->cursor >= job->end)
+			return 0;
+		curr = fly_atomic_inc(&job->cursor, grain) - grain;
+		if (curr >= job->end)
+			return 0;
+		*start = curr;
+		*end = ((job->end - curr) > grain) ? (curr + grain) : job->end;
+		return 1;
+	case FLY_PFOR_GUIDED:
+		do {
+			curr = job->cursor;
+			if (curr >= job->end)
+				return 0;
+			chunk = (job->end - curr + job->nbparts - 1) / job->nbparts;
+			if (chunk < grain)
+				chunk = grain;
+			if (chunk > (job->end - curr))
+				chunk = job->end - curr;
+		} while (!fly_atomic_cas(&job->cursor, curr, curr + chunk));
+		*start = curr;
+		*end = curr + chunk;
+		return 1;
+	case FLY_PFOR_NODE:
+	case FLY_PFOR_STATIC:
+	default:
+		{
+			struct fly_job_batch *batch;
+			if (job->nodes)
+				batch = job_claim_node_batch(job, node);
+			else
+				batch = fly_get_exec_batch(job);
+			if (batch) {
+				*start = batch->start;
+				*end = batch->end;
+				return 1;
+			}
+		}
+		return 0;
+	}
+}
+
+/*
+ * 0 once every range of the job is claimed, the job may still be running. Read
+ * without locking - the cursors only grow, a split which is being stolen may
+ * be missed, but its thief runs it.
+ */
+int fly_job_has_work(struct fly_job *job)
+{
+	switch (job->schedule) {
+	case FLY_PFOR_ADAPTIVE:
+		return job_splits_have_work(job);
+	case FLY_PFOR_DYNAMIC:
+	case FLY_PFOR_GUIDED:
+		return job->cursor < job->end;
+	case FLY_PFOR_NODE:
+	case FLY_PFOR_STATIC:
+	default:
+		if (job->nodes)
+			return job_nodes_have_work(job);
+		return job->next_batch < job->nbbatches;
 	}
-	return NULL;
+}
+
+int fly_job_range_done(struct fly_job *job, int start, int end)
+{
+	int units = end - start;
+	if ((job->schedule == FLY_PFOR_STATIC) || (job->schedule == FLY_PFOR_NODE))
+		units = 1;
+	return fly_atomic_inc(&job->batches_done, units) == job->nbbatches;
+}
+
+/* returns 0 if job already completed - the edge is not needed */
+int fly_job_add_succ(struct fly_job *job, struct fly_job_edge *edge,
+		struct fly_job *succ)
+{
+	struct fly_job_edge *head;
+	edge->succ = succ;
+	do {
+		head = job->succs;
+		if (head == FLY_JOB_SUCCS_CLOSED)
+			return 0;
+		edge->next = head;
+	} while (!fly_atomic_cas(&job->succs, head, edge));
+	return 1;
+}
+
+/* called once when job completes, returns the successors */
+struct fly_job_edge *fly_job_close_succs(struct fly_job *job)
+{
+	struct fly_job_edge *head;
+	do {
+		head = job->succs;
+	} while (!fly_atomic_cas(&job->succs, head, FLY_JOB_SUCCS_CLOSED));
+	return head;
+}
+
+void fly_job_queue_push(struct fly_task_queue *queue, struct fly_job *job)
+{
+	struct fly_job *head;
+	do {
+		head = queue->head;
+		job->qnext = head;
+	} while (!fly_atomic_cas(&queue->head, head, job));
+	fly_sem_post(&queue->sem);
+}
+
+/* the caller took a count of the sem - there is a job to take */
+struct fly_job *fly_job_queue_pop(struct fly_task_queue *queue)
+{
+	struct fly_job *job;
+	if (!queue->ready) {
+		struct fly_job *head;
+		do {
+			head = queue->head;
+		} while (!fly_atomic_cas(&queue->head, head, NULL));
+		/* reverse to completion order */
+		while (head) {
+			struct fly_job *next = head->qnext;
+			head->qnext = queue->ready;
+			queue->ready = head;
+			head = next;
+		}
+	}
+	job = queue->ready;
+	queue->ready = job->qnext;
+	return job;
+}
+
+/* the job is released here, the group may be destroyed once pending is 0 */
+void fly_job_group_done(struct fly_job *job)
+{
+	struct fly_task_group *group = job->group;
+	struct fly_task *task = job->data;
+	fly_atomic_inc(&group->users, 1);
+	fly_destroy_job(job);
+	task->sched_data = NULL;
+	if ((fly_atomic_dec(&group->pending, 1) == 0) && (group->nbwaiting > 0))
+		fly_futex_wake(&group->pending, INT_MAX);
+	fly_atomic_dec(&group->users, 1);
 }
 
 /******************************************************************************
  * Helper functions implementations.
  *****************************************************************************/
-static struct fly_job_batch *job_make_batch(struct fly_job *job,
+/* pooled jobs keep their semaphore initialized */
+static struct fly_job *job_alloc()
+{
+	struct fly_job *job = fly_sched_pool_get(FLY_POOL_JOB);
+	if (!job) {
+		job = fly_malloc(sizeof(struct fly_job));
+		if (job && (fly_sem_init(&job->sem) != 0)) {
+			fly_free(job);
+			job = NULL;
+		}
+	}
+	return job;
+}
+
+/* the defaults every constructor starts from, pooled jobs keep old values */
+static void job_init_common(struct fly_job *job, int jtype, void *data,
+		int start, int end)
+{
+	job->batches = NULL;
+	job->next_batch = 0;
+	job->nbbatches = 0;
+	job->batches_done = 0;
+	job->schedule = FLY_PFOR_STATIC;
+	job->grain = 0;
+	job->splits = NULL;
+	job->nodes = NULL;
+	job->deps = 0;
+	job->succs = NULL;
+	job->edges = NULL;
+	job->queue = NULL;
+	job->qnext = NULL;
+	job->group = NULL;
+	job->prio = FLY_PRIO_NORMAL;
+	job->readytime = 0;
+	job->data = data;
+	job->elsize = 0;
+	job->start = start;
+	job->end = end;
+	job->jtype = jtype;
+	job->recurse = 0;
+	job->users = 0;
+	job->state = FLY_JOB_IDLE;
+}
+
+static int job_alloc_batches(struct fly_job *job, int nbbatches)
+{
+	job->batches = fly_malloc(nbbatches * sizeof(struct fly_job_batch));
+	if (!job->batches)
+		return FLYENORES;
+	return FLYESUCCESS;
+}
+
+static void job_init_batch(struct fly_job_batch *batch, struct fly_job *job,
 		int start, int end)
 {
-	struct fly_job_batch *batch = fly_malloc(sizeof(struct fly_job_batch));
-	if (batch) {
-		batch->start = start;
-		batch->end = end;
-		batch->job = job;
-		batch->execed = 0;
+	batch->start = start;
+	batch->end = end;
+	batch->job = job;
+}
+
+/******************************************************************************
+ * Adaptive schedule(lazy binary splitting).
+ * The first nbparts splits hold one equal range each and are free for any
+ * thread to own. The rest are empty and used by threads which steal.
+ *****************************************************************************/
+#define FLY_JOB_SPLIT_FACTOR	16
+#define FLY_JOB_SPLIT_RETRIES	4
+
+static inline unsigned long long split_pack(int cur, int end)
+{
+	return ((unsigned long long)(unsigned int)cur << 32) | (unsigned int)end;
+}
+
+static inline int split_cur(unsigned long long range)
+{
+	return (int)(unsigned int)(range >> 32);
+}
+
+static inline int split_end(unsigned long long range)
+{
+	return (int)(unsigned int)range;
+}
+
+static int job_make_splits(struct fly_job *job, int nbparts)
+{
+	int funcscount = job->end - job->start;
+	int start = job->start;
+	int i;
+
+	if (nbparts > funcscount)
+		nbparts = funcscount;
+	job->nbsplits = 2 * nbparts;
+	job->splits = fly_malloc(job->nbsplits * sizeof(struct fly_job_split));
+	if (!job->splits)
+		return FLYENORES;
+	for (i = 0; i < job->nbsplits; i++) {
+		int end = start;
+		if (i < nbparts)
+			end += (funcscount / nbparts) +
+				((i < (funcscount % nbparts)) ? 1 : 0);
+		job->splits[i].range = split_pack(start, end);
+		job->splits[i].owned = 0;
+		start = end;
 	}
-	return batch;
+	return FLYESUCCESS;
 }
 
-static int job_add_batch(struct fly_job *job, struct fly_job_batch *batch)
+/* take a free split, a non empty one if any is left */
+static struct fly_job_split *split_acquire(struct fly_job *job, int *filled)
 {
-	return fly_list_append(&job->batches, batch);
+	struct fly_job_split *empty = NULL;
+	int i;
+	for (i = 0; i < job->nbsplits; i++) {
+		struct fly_job_split *s = &job->splits[i];
+		unsigned long long range = s->range;
+		if (s->owned)
+			continue;
+		if (split_cur(range) < split_end(range)) {
+			if (fly_atomic_cas(&s->owned, 0, 1)) {
+				*filled = 1;
+				return s;
+			}
+		} else if (!empty) {
+			empty = s;
+		}
+	}
+	*filled = 0;
+	if (empty && fly_atomic_cas(&empty->owned, 0, 1))
+		return empty;
+	return NULL;
 }
 
-static void job_remove_batch(struct fly_job *job, struct fly_job_batch *batch)
+/* move the upper half of the biggest range to the empty split */
+static int split_steal(struct fly_job *job, struct fly_job_split *split)
 {
-	fly_list_remove(&job->batches, batch);
+	int tries;
+	for (tries = 0; tries < FLY_JOB_SPLIT_RETRIES; tries++) {
+		struct fly_job_split *victim = NULL;
+		unsigned long long vrange = 0;
+		int most = 1;
+		int cur;
+		int mid;
+		int i;
+		for (i = 0; i < job->nbsplits; i++) {
+			unsigned long long range = job->splits[i].range;
+			int left = split_end(range) - split_cur(range);
+			if (left > most) {
+				most = left;
+				victim = &job->splits[i];
+				vrange = range;
+			}
+		}
+		if (!victim)
+			return 0;
+		cur = split_cur(vrange);
+		mid = cur + (most / 2);
+		if (fly_atomic_cas(&victim->range, vrange, split_pack(cur, mid))) {
+			fly_atomic_barrier();
+			split->range = split_pack(mid, split_end(vrange));
+			return 1;
+		}
+	}
+	return 0;
 }
 
-static void job_destroy_batch(struct fly_job_batch *batch)
+static int job_claim_split(struct fly_job *job, struct fly_job_split **split,
+		int *start, int *end)
 {
-	fly_free(batch);
+	struct fly_job_split *s = *split;
+	for (;;) {
+		if (!s) {
+			int filled;
+			s = split_acquire(job, &filled);
+			if (!s)
+				return 0;
+			if (!filled && !split_steal(job, s)) {
+				s->owned = 0;
+				return 0;
+			}
+			*split = s;
+		}
+		for (;;) {
+			unsigned long long range = s->range;
+			int cur = split_cur(range);
+			int left = split_end(range) - cur;
+			int chunk = job->grain;
+			if (left <= 0)
+				break;
+			if (chunk <= 0)
+				chunk = (left + FLY_JOB_SPLIT_FACTOR - 1) / FLY_JOB_SPLIT_FACTOR;
+			if (chunk > left)
+				chunk = left;
+			if (fly_atomic_cas(&s->range, range,
+						split_pack(cur + chunk, split_end(range)))) {
+				*start = cur;
+				*end = cur + chunk;
+				return 1;
+			}
+		}
+		/* own range is over - give the split back and look for more */
+		s->owned = 0;
+		s = NULL;
+		*split = NULL;
+	}
+}
+
+/* a free split with a range left or an owned one which can be split */
+static int job_splits_have_work(struct fly_job *job)
+{
+	int i;
+	for (i = 0; i < job->nbsplits; i++) {
+		unsigned long long range = job->splits[i].range;
+		int left = split_end(range) - split_cur(range);
+		if ((left > 1) || ((left == 1) && !job->splits[i].owned))
+			return 1;
+	}
+	return 0;
+}
+
+/******************************************************************************
+ * Node schedule.
+ * The batches are sorted by the NUMA node of their data and the workers take
+ * the batches of their own node before they help the other nodes. A batch
+ * belongs to the node of the page holding its first element, or to the node
+ * of the worker which would run it with FLY_PFOR_STATIC when that is unknown
+ * or the page was not touched yet - the lookup must not place it.
+ *****************************************************************************/
+/* the first elements of the batches are looked up in one pass */
+static int job_batch_nodes(struct fly_job *job, int *nodeof, int nbnodes)
+{
+	int nbworkers = fly_get_nbworkers();
+	const void **addrs;
+	int i;
+
+	for (i = 0; i < job->nbbatches; i++)
+		nodeof[i] = -1;
+	if ((job->jtype == FLY_TASK_PARALLEL_FOR_ARR) ||
+			(job->jtype == FLY_TASK_PARALLEL_RANGE_ARR)) {
+		addrs = fly_malloc(job->nbbatches * sizeof(void*));
+		if (!addrs)
+			return FLYENORES;
+		for (i = 0; i < job->nbbatches; i++)
+			addrs[i] = (char*)job->data + (job->batches[i].start * job->elsize);
+		fly_sched_addrs_nodes(addrs, nodeof, job->nbbatches);
+		fly_free(addrs);
+	}
+	for (i = 0; i < job->nbbatches; i++) {
+		if ((nodeof[i] < 0) || (nodeof[i] >= nbnodes))
+			nodeof[i] = fly_sched_worker_node((i * nbworkers) / job->nbbatches);
+	}
+	return FLYESUCCESS;
+}
+
+/* no node cursors with a single node - the job runs as FLY_PFOR_STATIC */
+static int job_make_nodes(struct fly_job *job)
+{
+	int nbnodes = fly_sched_get_nbnodes();
+	struct fly_job_batch *sorted;
+	int *nodeof;
+	int first;
+	int i;
+
+	if (nbnodes < 2)
+		return FLYESUCCESS;
+	job->nodes = fly_malloc(nbnodes * sizeof(struct fly_job_node));
+	sorted = fly_malloc(job->nbbatches * sizeof(struct fly_job_batch));
+	nodeof = fly_malloc(job->nbbatches * sizeof(int));
+	if (!job->nodes || !sorted || !nodeof) {
+		if (sorted)
+			fly_free(sorted);
+		if (nodeof)
+			fly_free(nodeof);
+		return FLYENORES;
+	}
+	job->nbnodes = nbnodes;
+	for (i = 0; i < nbnodes; i++)
+		job->nodes[i].end = 0;
+	if (!FLY_SUCCEEDED(job_batch_nodes(job, nodeof, nbnodes))) {
+		fly_free(sorted);
+		fly_free(nodeof);
+		return FLYENORES;
+	}
+	for (i = 0; i < job->nbbatches; i++)
+		job->nodes[nodeof[i]].end++;
+	/* counting sort, next runs over the slots of the node */
+	first = 0;
+	for (i = 0; i < nbnodes; i++) {
+		int count = job->nodes[i].end;
+		job->nodes[i].next = first;
+		first += count;
+	}
+	for (i = 0; i < job->nbbatches; i++)
+		sorted[job->nodes[nodeof[i]].next++] = job->batches[i];
+	first = 0;
+	for (i = 0; i < nbnodes; i++) {
+		job->nodes[i].end = job->nodes[i].next;
+		job->nodes[i].next = first;
+		first = job->nodes[i].end;
+	}
+	fly_free(job->batches);
+	fly_free(nodeof);
+	job->batches = sorted;
+	return FLYESUCCESS;
+}
+
+static struct fly_job_batch *job_claim_node_batch(struct fly_job *job,
+		int node)
+{
+	int i;
+	for (i = 0; i < job->nbnodes; i++) {
+		struct fly_job_node *jn = &job->nodes[(node + i) % job->nbnodes];
+		int ind;
+		if (jn->next >= jn->end)
+			continue;
+		ind = fly_atomic_inc(&jn->next, 1) - 1;
+		if (ind < jn->end)
+			return &job->batches[ind];
+	}
+	return NULL;
+}
+
+static int job_nodes_have_work(struct fly_job *job)
+{
+	int i;
+	for (i = 0; i < job->nbnodes; i++) {
+		if (job->nodes[i].next < job->nodes[i].end)
+			return 1;
+	}
+	return 0;
 }
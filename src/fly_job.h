@@ -25,6 +25,7 @@
 #include <libfly/fly.h>
 #include "fly_list.h"
 #include "fly_sem.h"
+#include "fly_globals.h"
 
 #include <stdlib.h>
 
@@ -33,16 +34,99 @@ enum fly_job_state {
 	FLY_JOB_PREPARING,
 	FLY_JOB_READY,
 	FLY_JOB_RUNNING,
-	FLY_JOB_DONE
+	FLY_JOB_DONE,
+	FLY_JOB_COLLECTED
 }; /* enum fly_job_state */
 
+/*
+ * Published [cur, end) range of FLY_PFOR_ADAPTIVE, packed as cur << 32 | end.
+ * The owner takes chunks from cur, thieves split off the upper half.
+ */
+struct fly_job_split {
+	volatile unsigned long long	range;
+	volatile int				owned;
+	char	pad[FLY_CACHE_LINE_SIZE - sizeof(unsigned long long) - sizeof(int)];
+}; /* struct fly_job_split */
+
+/*
+ * Batches of one NUMA node for FLY_PFOR_NODE, [next, end) indexes the batches
+ * which are not taken yet.
+ */
+struct fly_job_node {
+	volatile int	next;
+	int				end;
+	char			pad[FLY_CACHE_LINE_SIZE - 2 * sizeof(int)];
+}; /* struct fly_job_node */
+
+/*
+ * Edge of the task graph, kept by the successor - one per dependency. The
+ * edges are linked in the succs list of the predecessor.
+ */
+struct fly_job_edge {
+	struct fly_job		*succ;
+	struct fly_job_edge	*next;
+}; /* struct fly_job_edge */
+
+/* succs of a job which completed, no edges are added any more */
+#define FLY_JOB_SUCCS_CLOSED	((struct fly_job_edge*)1)
+
+/*
+ * Completed task jobs, pushed by the workers and taken by one thread. The
+ * sem has a count for every job in the queue.
+ */
+struct fly_task_queue {
+	struct fly_job *volatile	head; /* newest first */
+	struct fly_job				*ready; /* taken from head, oldest first */
+	volatile int				pending; /* pushed tasks not taken yet */
+	struct fly_sem				sem;
+}; /* struct fly_task_queue */
+
+/*
+ * Task jobs of a group are not waited for one by one. The worker which
+ * completes one releases it and counts pending down, users keeps the group
+ * alive until it is done with it.
+ */
+struct fly_task_group {
+	volatile int	pending;
+	volatile int	nbwaiting;
+	volatile int	cancelled;
+	volatile int	users;
+}; /* struct fly_task_group */
+
+/*
+ * nbbatches and batches_done count batches for FLY_PFOR_STATIC and
+ * FLY_PFOR_NODE and iterations
+ * for the schedules driven by cursor or splits.
+ */
 struct fly_job {
-	struct fly_list		batches;
+	struct fly_job_batch	*batches;
+	volatile int		next_batch;
 	int					nbbatches;
 	volatile int		batches_done;
 
+	enum fly_pfor_schedule	schedule;
+	int					grain;
+	int					nbparts;
+	volatile int		cursor;
+	struct fly_job_split	*splits;
+	int					nbsplits;
+	struct fly_job_node	*nodes;
+	int					nbnodes;
+
+	/* task dependencies - predecessors left and the successors */
+	volatile int		deps;
+	struct fly_job_edge	*volatile succs;
+	struct fly_job_edge	*edges;
+
+	struct fly_task_queue	*queue;
+	struct fly_job		*qnext;
+	struct fly_task_group	*group;
+	enum fly_task_prio	prio;
+	long long			readytime; /* when it was added, for prio aging */
+
 	union {
 		fly_parallel_for_func	pfor;
+		fly_parallel_range_func	prange;
 		fly_task_func			tfunc;
 	}					func;
 
@@ -52,6 +136,8 @@ struct fly_job {
 	int					end;
 	int					jtype;
 	int					recurse;
+	volatile int		users;
+	struct fly_list		node; /* links the job in the fly_sched lists */
 	enum fly_job_state	state;
 	struct fly_sem		sem;
 }; /* struct fly_job */
@@ -60,19 +146,36 @@ struct fly_job_batch {
 	struct fly_job	*job;
 	int				start;
 	int				end;
-	int				execed;
 }; /* struct fly_job_batch */
 
 struct fly_job *fly_create_job_pfor(int count, fly_parallel_for_func func,
 		void *ptr);
 struct fly_job *fly_create_job_pfarr(int start, int end,
 		fly_parallel_for_func func, void *data, size_t elsize);
+struct fly_job *fly_create_job_prange(int start, int end,
+		fly_parallel_range_func func, void *ptr);
+struct fly_job *fly_create_job_prarr(int start, int end,
+		fly_parallel_range_func func, void *data, size_t elsize);
 struct fly_job *fly_create_job_task(struct fly_task *task);
 void fly_destroy_job(struct fly_job *job);
+void fly_job_release(void *job);
 int fly_wait_job(struct fly_job *job);
 int fly_job_is_done(struct fly_job *job);
 int fly_make_batches(struct fly_job *job, int nbbatches);
+int fly_job_parallelism(struct fly_job *job);
 void fly_destroy_batches(struct fly_job *job);
 struct fly_job_batch *fly_get_exec_batch(struct fly_job *job);
+void fly_job_set_schedule(struct fly_job *job,
+		enum fly_pfor_schedule schedule, int grain);
+int fly_job_claim_range(struct fly_job *job, int node,
+		struct fly_job_split **split, int *start, int *end);
+int fly_job_has_work(struct fly_job *job);
+int fly_job_range_done(struct fly_job *job, int start, int end);
+int fly_job_add_succ(struct fly_job *job, struct fly_job_edge *edge,
+		struct fly_job *succ);
+struct fly_job_edge *fly_job_close_succs(struct fly_job *job);
+void fly_job_queue_push(struct fly_task_queue *queue, struct fly_job *job);
+struct fly_job *fly_job_queue_pop(struct fly_task_queue *queue);
+void fly_job_group_done(struct fly_job *job);
 
 #endif /* FLY_JOB_H */
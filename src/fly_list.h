@@ -61,12 +61,12 @@ static inline struct fly_list *fly_list_tail(struct fly_list *list)
 static inline void fly_list_append_node(struct fly_list *list,
 		struct fly_list *node)
 {
-	if (list->prev) {
+	node->next = NULL;
+	node->prev = list->prev;
+	if (list->prev)
 		list->prev->next = node;
-		node->prev = list->prev;
-	} else {
+	else
 		list->next = node;
-	}
 	list->prev = node;
 }
 
@@ -84,7 +84,12 @@ static inline int fly_list_append(struct fly_list *list, void *el)
 static inline void fly_list_prepend_node(struct fly_list *list,
 		struct fly_list *node)
 {
+	node->prev = NULL;
 	node->next = list->next;
+	if (list->next)
+		list->next->prev = node;
+	else
+		list->prev = node;
 	list->next = node;
 }
 
@@ -99,24 +104,20 @@ static inline int fly_list_prepend(struct fly_list *list, void *el)
 	return FLYENORES;
 }
 
+/* node must be in list */
 static inline void fly_list_remove_node(struct fly_list *list,
 		struct fly_list *node)
 {
-	struct fly_list *head = fly_list_head(list);
-	if (list->next == node)
+	if (node->prev)
+		node->prev->next = node->next;
+	else
 		list->next = node->next;
-	if (list->prev == node)
+	if (node->next)
+		node->next->prev = node->prev;
+	else
 		list->prev = node->prev;
-
-	while (head && (head != node)) {
-		head = head->next;
-	}
-	if (head) {
-		if (head->prev)
-			head->prev->next = head->next;
-		if (head->next)
-			head->next->prev = head->prev;
-	}
+	node->next = NULL;
+	node->prev = NULL;
 }
 
 static inline struct fly_list *fly_list_get(struct fly_list *list, void *el)
@@ -155,4 +156,13 @@ static inline void *fly_list_tail_remove(struct fly_list *list)
 	return ret;
 }
 
+/* as fly_list_tail_remove, but for nodes which are not allocated by the list */
+static inline struct fly_list *fly_list_tail_remove_node(struct fly_list *list)
+{
+	struct fly_list *tail = fly_list_tail(list);
+	if (tail)
+		fly_list_remove_node(list, tail);
+	return tail;
+}
+
 #endif /* FLY_LIST_H */
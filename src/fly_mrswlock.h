@@ -30,14 +30,14 @@
 #define LIBFLY_FLY_MRSWLOCK_H
 
 #include "fly_thread.h"
+#include "fly_sem.h"
 
 #include <pthread.h>
-#include <semaphore.h>
 
 struct fly_mrswlock {
 	pthread_mutex_t	plock;
-	sem_t			rsem;
-	sem_t			wsem;
+	struct fly_sem	rsem;
+	struct fly_sem	wsem;
 	int				nbin;
 	int				nbrwaiting;
 	int				nbwwaiting;
@@ -47,8 +47,8 @@ struct fly_mrswlock {
 static inline int fly_mrswlock_init(struct fly_mrswlock *lock, int maxin)
 {
 	pthread_mutex_init(&lock->plock, NULL);
-	sem_init(&lock->rsem, 0, 0);
-	sem_init(&lock->wsem, 0, 0);
+	fly_sem_init(&lock->rsem);
+	fly_sem_init(&lock->wsem);
 	lock->nbin = 0;
 	lock->nbrwaiting = 0;
 	lock->nbwwaiting = 0;
@@ -59,8 +59,8 @@ static inline int fly_mrswlock_init(struct fly_mrswlock *lock, int maxin)
 static inline void fly_mrswlock_uninit(struct fly_mrswlock *lock)
 {
 	pthread_mutex_destroy(&lock->plock);
-	sem_destroy(&lock->rsem);
-	sem_destroy(&lock->wsem);
+	fly_sem_uninit(&lock->rsem);
+	fly_sem_uninit(&lock->wsem);
 }
 
 static inline int fly_mrswlock_notrack_rlock(struct fly_mrswlock *lock)
@@ -88,9 +88,9 @@ static inline int fly_mrswlock_notrack_rlock(struct fly_mrswlock *lock)
 			pthread_mutex_unlock(&lock->plock);
 			if (wakewriters) {
 				wakewriters = 0;
-				sem_post(&lock->wsem);
+				fly_sem_post(&lock->wsem);
 			} else {
-				sem_wait(&lock->rsem);
+				fly_sem_notrack_wait(&lock->rsem);
 			}
 		}
 	}
@@ -115,7 +115,7 @@ static inline int fly_mrswlock_notrack_wlock(struct fly_mrswlock *lock)
 				waiting = 1;
 			}
 			pthread_mutex_unlock(&lock->plock);
-			sem_wait(&lock->wsem);
+			fly_sem_notrack_wait(&lock->wsem);
 		}
 	}
 	return hasit;
@@ -151,9 +151,9 @@ static inline int fly_mrswlock_runlock(struct fly_mrswlock *lock)
 	nbwwaiting = lock->nbwwaiting;
 	pthread_mutex_unlock(&lock->plock);
 	if (nbwwaiting > 0)
-		sem_post(&lock->wsem);
+		fly_sem_post(&lock->wsem);
 	else if (nbrwaiting > 0)
-		sem_post(&lock->rsem);
+		fly_sem_post(&lock->rsem);
 	return 0;
 }
 
@@ -167,9 +167,9 @@ static inline int fly_mrswlock_wunlock(struct fly_mrswlock *lock)
 	nbwwaiting = lock->nbwwaiting;
 	pthread_mutex_unlock(&lock->plock);
 	if (nbwwaiting > 0)
-		sem_post(&lock->wsem);
+		fly_sem_post(&lock->wsem);
 	else if (nbrwaiting > 0)
-		sem_post(&lock->rsem);
+		fly_sem_post(&lock->rsem);
 	return 0;
 }
 
@@ -0,0 +1,178 @@
+/******************************************************************************
+ * fly_pool.h
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+/*
+ * Free lists of released objects, so they could be reused without going
+ * through fly_malloc. A fly_pool belongs to one thread and is not locked.
+ * fly_shared_pool is used by the threads which are not workers and to
+ * rebalance the worker pools - full pools give half of their objects to it
+ * and empty pools refill from it.
+ */
+
+#ifndef LIBFLY_FLY_POOL_H
+#define LIBFLY_FLY_POOL_H
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#define FLY_POOL_JOB		0
+#define FLY_POOL_TASK		1
+#define FLY_POOL_NB_TYPES	2
+
+#define FLY_POOL_MAX_LOCAL	256
+#define FLY_POOL_MAX_SHARED	4096
+#define FLY_POOL_REFILL		32
+
+typedef void (*fly_pool_release_func)(void*);
+
+struct fly_pool_node {
+	struct fly_pool_node	*next;
+}; /* struct fly_pool_node */
+
+struct fly_pool {
+	struct fly_pool_node	*head;
+	int						count;
+	unsigned long			hits;
+	unsigned long			misses;
+}; /* struct fly_pool */
+
+struct fly_shared_pool {
+	pthread_mutex_t		lock;
+	struct fly_pool		pool;
+}; /* struct fly_shared_pool */
+
+static inline void fly_pool_init(struct fly_pool *pool)
+{
+	pool->head = NULL;
+	pool->count = 0;
+	pool->hits = 0;
+	pool->misses = 0;
+}
+
+static inline void fly_pool_uninit(struct fly_pool *pool,
+		fly_pool_release_func release)
+{
+	while (pool->head) {
+		struct fly_pool_node *node = pool->head;
+		pool->head = node->next;
+		release(node);
+	}
+	pool->count = 0;
+}
+
+static inline void *fly_pool_get(struct fly_pool *pool)
+{
+	struct fly_pool_node *node = pool->head;
+	if (node) {
+		pool->head = node->next;
+		pool->count--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	return node;
+}
+
+static inline void fly_pool_put(struct fly_pool *pool, void *obj)
+{
+	struct fly_pool_node *node = obj;
+	node->next = pool->head;
+	pool->head = node;
+	pool->count++;
+}
+
+/* moves up to count objects, the statistics stay with the pools */
+static inline void fly_pool_move(struct fly_pool *from, struct fly_pool *to,
+		int count)
+{
+	while (from->head && (count-- > 0)) {
+		struct fly_pool_node *node = from->head;
+		from->head = node->next;
+		from->count--;
+		fly_pool_put(to, node);
+	}
+}
+
+static inline void fly_shared_pool_init(struct fly_shared_pool *shared)
+{
+	pthread_mutex_init(&shared->lock, NULL);
+	fly_pool_init(&shared->pool);
+}
+
+static inline void fly_shared_pool_uninit(struct fly_shared_pool *shared,
+		fly_pool_release_func release)
+{
+	fly_pool_uninit(&shared->pool, release);
+	pthread_mutex_destroy(&shared->lock);
+}
+
+static inline void *fly_shared_pool_get(struct fly_shared_pool *shared)
+{
+	void *obj;
+	pthread_mutex_lock(&shared->lock);
+	obj = fly_pool_get(&shared->pool);
+	pthread_mutex_unlock(&shared->lock);
+	return obj;
+}
+
+/* returns 0 if the pool is full and obj should be released */
+static inline int fly_shared_pool_put(struct fly_shared_pool *shared,
+		void *obj)
+{
+	int taken = 0;
+	pthread_mutex_lock(&shared->lock);
+	if (shared->pool.count < FLY_POOL_MAX_SHARED) {
+		fly_pool_put(&shared->pool, obj);
+		taken = 1;
+	}
+	pthread_mutex_unlock(&shared->lock);
+	return taken;
+}
+
+static inline void fly_shared_pool_refill(struct fly_shared_pool *shared,
+		struct fly_pool *pool)
+{
+	/* racy peek - only saves the lock when there is nothing to take */
+	if (!shared->pool.head)
+		return;
+	pthread_mutex_lock(&shared->lock);
+	fly_pool_move(&shared->pool, pool, FLY_POOL_REFILL);
+	pthread_mutex_unlock(&shared->lock);
+}
+
+static inline void fly_shared_pool_spill(struct fly_shared_pool *shared,
+		struct fly_pool *pool)
+{
+	pthread_mutex_lock(&shared->lock);
+	fly_pool_move(pool, &shared->pool, pool->count / 2);
+	pthread_mutex_unlock(&shared->lock);
+}
+
+/* the whole pool, of a thread which stops using it */
+static inline void fly_shared_pool_collect(struct fly_shared_pool *shared,
+		struct fly_pool *pool)
+{
+	pthread_mutex_lock(&shared->lock);
+	fly_pool_move(pool, &shared->pool, pool->count);
+	pthread_mutex_unlock(&shared->lock);
+}
+
+#endif /* LIBFLY_FLY_POOL_H */
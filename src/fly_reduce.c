@@ -0,0 +1,152 @@
+/******************************************************************************
+ * fly_reduce.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+#include "fly_globals.h"
+#include "fly_sched.h"
+
+#include <string.h> /* for memcpy */
+
+/*
+ * The range is cut in chunks with one partial each. FLY_REDUCE_DETERMINISTIC
+ * cuts chunks of a fixed size whatever the number of workers, and the
+ * partials are always combined in the same tree:
+ * ((p0 p1) (p2 p3)) ((p4 p5) p6)...
+ * so the result depends only on the range and grain.
+ */
+#define FLY_REDUCE_CHUNKS_PER_WORKER	4
+#define FLY_REDUCE_DETERMINISTIC_GRAIN	1024
+#define FLY_REDUCE_SEQ_PAIRS			64
+
+struct fly_reduce {
+	int							start;
+	int							end;
+	int							chunk;
+	int							nbchunks;
+	int							step; /* distance of the combined partials */
+	size_t						elsize;
+	size_t						stride; /* partials do not share lines */
+	char						*partials;
+	const void					*identity;
+	fly_parallel_map_func		map;
+	fly_parallel_combine_func	combine;
+	void						*ptr;
+}; /* struct fly_reduce */
+
+static inline void *reduce_partial(struct fly_reduce *r, int ind)
+{
+	return r->partials + (ind * r->stride);
+}
+
+static void reduce_chunk(int ind, void *param)
+{
+	struct fly_reduce *r = param;
+	void *partial = reduce_partial(r, ind);
+	int start = r->start + (ind * r->chunk);
+	int end = ((r->end - start) > r->chunk) ? (start + r->chunk) : r->end;
+	memcpy(partial, r->identity, r->elsize);
+	r->map(start, end, partial, r->ptr);
+}
+
+/* pair ind of the current level, the left partial takes the right one */
+static void reduce_pair(int ind, void *param)
+{
+	struct fly_reduce *r = param;
+	int left = ind * 2 * r->step;
+	if ((left + r->step) < r->nbchunks)
+		r->combine(reduce_partial(r, left), reduce_partial(r, left + r->step),
+				r->ptr);
+}
+
+static int reduce_combine(struct fly_reduce *r)
+{
+	int err = FLYESUCCESS;
+	for (r->step = 1; r->step < r->nbchunks; r->step *= 2) {
+		int nbpairs = (r->nbchunks + (2 * r->step) - 1) / (2 * r->step);
+		if (nbpairs > FLY_REDUCE_SEQ_PAIRS) {
+			err = fly_parallel_for(nbpairs, reduce_pair, r);
+			if (!FLY_SUCCEEDED(err))
+				break;
+		} else {
+			int i;
+			for (i = 0; i < nbpairs; i++)
+				reduce_pair(i, r);
+		}
+	}
+	return err;
+}
+
+int fly_parallel_reduce_ex(int start, int end, const void *identity,
+		size_t elsize, fly_parallel_map_func map,
+		fly_parallel_combine_func combine, void *ptr, void *result,
+		enum fly_reduce_mode mode, int grain)
+{
+	struct fly_reduce r;
+	char *mem;
+	int count = end - start;
+	int err;
+
+	if (count <= 0) {
+		memcpy(result, identity, elsize);
+		return FLYESUCCESS;
+	}
+	if (grain <= 0) {
+		if (mode == FLY_REDUCE_DETERMINISTIC) {
+			grain = FLY_REDUCE_DETERMINISTIC_GRAIN;
+		} else {
+			int nbchunks = fly_get_nbworkers() * FLY_REDUCE_CHUNKS_PER_WORKER;
+			grain = (count + nbchunks - 1) / nbchunks;
+		}
+	}
+	r.start = start;
+	r.end = end;
+	r.chunk = grain;
+	r.nbchunks = (count + grain - 1) / grain;
+	r.elsize = elsize;
+	r.stride = ((elsize + FLY_CACHE_LINE_SIZE - 1) / FLY_CACHE_LINE_SIZE) *
+		FLY_CACHE_LINE_SIZE;
+	r.identity = identity;
+	r.map = map;
+	r.combine = combine;
+	r.ptr = ptr;
+	mem = fly_malloc((r.nbchunks * r.stride) + FLY_CACHE_LINE_SIZE);
+	if (!mem)
+		return FLYENORES;
+	r.partials = mem + FLY_CACHE_LINE_SIZE -
+		((size_t)mem % FLY_CACHE_LINE_SIZE);
+
+	err = fly_parallel_for_ex(r.nbchunks, reduce_chunk, &r,
+			FLY_PFOR_DYNAMIC, 1);
+	if (FLY_SUCCEEDED(err))
+		err = reduce_combine(&r);
+	if (FLY_SUCCEEDED(err))
+		memcpy(result, reduce_partial(&r, 0), elsize);
+	fly_free(mem);
+	return err;
+}
+
+int fly_parallel_reduce(int start, int end, const void *identity,
+		size_t elsize, fly_parallel_map_func map,
+		fly_parallel_combine_func combine, void *ptr, void *result)
+{
+	return fly_parallel_reduce_ex(start, end, identity, elsize, map, combine,
+			ptr, result, FLY_REDUCE_FAST, 0);
+}
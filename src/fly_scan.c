@@ -0,0 +1,176 @@
+/******************************************************************************
+ * fly_scan.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+#include "fly_globals.h"
+#include "fly_sched.h"
+
+#include <string.h> /* for memcpy */
+
+/*
+ * Two pass scan. The first pass reduces every chunk but the last to its total,
+ * the totals are scanned to the carry into every chunk and the second pass
+ * scans the chunks starting from their carry.
+ */
+#define FLY_SCAN_CHUNKS_PER_WORKER	4
+#define FLY_SCAN_MIN_CHUNK			1024
+
+struct fly_scan {
+	int							start;
+	int							end;
+	int							chunk;
+	int							nbchunks;
+	const char					*in;
+	char						*out;
+	size_t						elsize;
+	size_t						stride;
+	char						*slots; /* total and temporary per chunk */
+	const void					*identity;
+	fly_parallel_combine_func	op;
+	void						*ptr;
+	enum fly_scan_type			type;
+}; /* struct fly_scan */
+
+static inline void *scan_total(struct fly_scan *s, int ind)
+{
+	return s->slots + (2 * ind * s->stride);
+}
+
+static inline void *scan_tmp(struct fly_scan *s, int ind)
+{
+	return s->slots + (((2 * ind) + 1) * s->stride);
+}
+
+static inline void scan_chunk_range(struct fly_scan *s, int ind,
+		int *start, int *end)
+{
+	*start = s->start + (ind * s->chunk);
+	*end = ((s->end - *start) > s->chunk) ? (*start + s->chunk) : s->end;
+}
+
+static void scan_reduce_chunk(int ind, void *param)
+{
+	struct fly_scan *s = param;
+	void *total = scan_total(s, ind);
+	const char *in;
+	int start;
+	int end;
+	int i;
+	scan_chunk_range(s, ind, &start, &end);
+	in = s->in + (start * s->elsize);
+	memcpy(total, s->identity, s->elsize);
+	for (i = start; i < end; i++) {
+		s->op(total, in, s->ptr);
+		in += s->elsize;
+	}
+}
+
+/* in may be out, so an exclusive scan saves the element before writing */
+static void scan_chunk(int ind, void *param)
+{
+	struct fly_scan *s = param;
+	void *acc = scan_total(s, ind);
+	void *tmp = scan_tmp(s, ind);
+	const char *in;
+	char *out;
+	int start;
+	int end;
+	int i;
+	scan_chunk_range(s, ind, &start, &end);
+	in = s->in + (start * s->elsize);
+	out = s->out + (start * s->elsize);
+	for (i = start; i < end; i++) {
+		if (s->type == FLY_SCAN_INCLUSIVE) {
+			s->op(acc, in, s->ptr);
+			memcpy(out, acc, s->elsize);
+		} else {
+			memcpy(tmp, in, s->elsize);
+			memcpy(out, acc, s->elsize);
+			s->op(acc, tmp, s->ptr);
+		}
+		in += s->elsize;
+		out += s->elsize;
+	}
+}
+
+/* turns the totals into the carries into the chunks */
+static void scan_totals(struct fly_scan *s)
+{
+	void *carry = scan_total(s, s->nbchunks);
+	int last = s->nbchunks - 1;
+	int i;
+	memcpy(carry, s->identity, s->elsize);
+	for (i = 0; i < last; i++) {
+		memcpy(scan_tmp(s, i), scan_total(s, i), s->elsize);
+		memcpy(scan_total(s, i), carry, s->elsize);
+		s->op(carry, scan_tmp(s, i), s->ptr);
+	}
+	memcpy(scan_total(s, last), carry, s->elsize);
+}
+
+int fly_parallel_scan(int start, int end, const void *in, void *out,
+		size_t elsize, const void *identity, fly_parallel_combine_func op,
+		void *ptr, enum fly_scan_type type)
+{
+	struct fly_scan s;
+	char *mem;
+	int count = end - start;
+	int nbchunks;
+	int err = FLYESUCCESS;
+
+	if (count <= 0)
+		return FLYESUCCESS;
+	nbchunks = fly_get_nbworkers() * FLY_SCAN_CHUNKS_PER_WORKER;
+	s.chunk = (count + nbchunks - 1) / nbchunks;
+	if (s.chunk < FLY_SCAN_MIN_CHUNK)
+		s.chunk = FLY_SCAN_MIN_CHUNK;
+	s.start = start;
+	s.end = end;
+	s.nbchunks = (count + s.chunk - 1) / s.chunk;
+	s.in = in;
+	s.out = out;
+	s.elsize = elsize;
+	s.stride = ((elsize + FLY_CACHE_LINE_SIZE - 1) / FLY_CACHE_LINE_SIZE) *
+		FLY_CACHE_LINE_SIZE;
+	s.identity = identity;
+	s.op = op;
+	s.ptr = ptr;
+	s.type = type;
+	/* one more pair of slots for scan_totals */
+	mem = fly_malloc((2 * (s.nbchunks + 1) * s.stride) + FLY_CACHE_LINE_SIZE);
+	if (!mem)
+		return FLYENORES;
+	s.slots = mem + FLY_CACHE_LINE_SIZE - ((size_t)mem % FLY_CACHE_LINE_SIZE);
+
+	if (s.nbchunks > 1) {
+		/* the total of the last chunk is not needed */
+		err = fly_parallel_for(s.nbchunks - 1, scan_reduce_chunk, &s);
+		if (FLY_SUCCEEDED(err)) {
+			scan_totals(&s);
+			err = fly_parallel_for(s.nbchunks, scan_chunk, &s);
+		}
+	} else {
+		memcpy(scan_total(&s, 0), identity, elsize);
+		scan_chunk(0, &s);
+	}
+	fly_free(mem);
+	return err;
+}
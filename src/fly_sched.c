@@ -27,6 +27,10 @@
 #include "fly_job.h"
 #include "fly_task.h"
 #include "fly_atomic.h"
+#include "fly_topology.h"
+
+#include <limits.h> /* for INT_MAX */
+#include <unistd.h> /* for sysconf */
 
 /******************************************************************************
  * Init/uninit helper functions declarations
@@ -34,6 +38,7 @@
 #define FLY_SCHED_ONE_LOCKS		1
 #define FLY_SCHED_TWO_LOCKS		2
 #define FLY_SCHED_TREE_LOCKS	3
+#define FLY_SCHED_FOUR_LOCKS	4
 #define FLY_SCHED_MAX_RLOCK		256
 static inline int fly_sched_init_locks();
 static inline void fly_sched_uninit_locks(int nb);
@@ -43,26 +48,54 @@ static inline int fly_sched_thread_init();
 static inline int fly_sched_thread_uninit();
 static inline int fly_sched_workers_init();
 static inline int fly_sched_workers_uninit(int nbworkers);
+static inline void fly_sched_init_pools();
+static inline void fly_sched_uninit_pools();
+static inline void fly_sched_collect_pools(struct fly_worker_thread *wthread);
 
 /******************************************************************************
  * Job helper functions declarations
  *****************************************************************************/
+static inline void fly_sched_list_append(struct fly_list *list,
+		struct fly_job *job);
 static inline int fly_sched_add_to_ready(struct fly_job *job);
 static int fly_sched_add_pfj(struct fly_job *job);
 static int fly_taskjob_exec(struct fly_job *job);
-static struct fly_job *fly_sched_get_ready(struct fly_thread *t);
+static struct fly_job *fly_sched_get_ready(struct fly_thread *t, int maxprio);
 static struct fly_job *fly_sched_get_running(struct fly_thread *t);
 static void fly_sched_move_to_running(struct fly_job *job, struct fly_thread *t);
 static void fly_sched_remove_running(struct fly_job *job);
 static void fly_sched_move_to_done(struct fly_job *job);
+static struct fly_job *fly_sched_steal(struct fly_worker_thread *wthread);
+static struct fly_job *fly_sched_steal_attached(
+		struct fly_worker_thread *wthread);
+static void fly_sched_start_job(struct fly_job *job,
+		struct fly_worker_thread *wthread);
 static struct fly_job *fly_sched_get_job(struct fly_worker_thread *wthread);
-static int fly_sched_exec_job(struct fly_job *job);
+static inline int fly_sched_caller_node();
+static int fly_sched_exec_job_on(struct fly_job *job,
+		struct fly_worker_thread *wthread, int node);
+static inline int fly_sched_exec_job(struct fly_job *job,
+		struct fly_worker_thread *wthread);
+static void fly_sched_task_done(struct fly_job *job,
+		struct fly_worker_thread *wthread);
+static void fly_sched_wake(int nb, struct fly_worker *self);
+static void fly_sched_wait_work(struct fly_worker_thread *wthread);
 
 /******************************************************************************
  * Scheduling helper functions declarations
  *****************************************************************************/
-static int fly_pfarrj_exec(struct fly_job *job);
-static int fly_pfptrj_exec(struct fly_job *job);
+static int fly_pfarrj_exec(struct fly_job *job, int node, int *done);
+static int fly_pfptrj_exec(struct fly_job *job, int node, int *done);
+static int fly_prarrj_exec(struct fly_job *job, int node, int *done);
+static int fly_prptrj_exec(struct fly_job *job, int node, int *done);
+
+static inline int fly_sched_is_batched(struct fly_job *job)
+{
+	return (job->jtype == FLY_TASK_PARALLEL_FOR) ||
+		(job->jtype == FLY_TASK_PARALLEL_FOR_ARR) ||
+		(job->jtype == FLY_TASK_PARALLEL_RANGE) ||
+		(job->jtype == FLY_TASK_PARALLEL_RANGE_ARR);
+}
 
 /******************************************************************************
  * fly_sched thread
@@ -74,11 +107,39 @@ static void *fly_sched_thread_func(void *param)
 
 	while (fly_sched.threadstate == FLY_SCHED_THREAD_RUNNING) {
 		fly_sched_update();
-		fly_thread_sleep(FLY_SCHED_UPDATE_INTERVAL_US);
+		fly_thread_sleep(FLY_SCHED_UPDATE_INTERVAL_US * 1000);
+		/* no jobs outstanding - sleep until one is added */
+		fly_sched.threadsleeping = 1;
+		fly_atomic_barrier();
+		if ((fly_sched.pending > 0) &&
+				fly_atomic_cas(&fly_sched.threadsleeping, 1, 0))
+			continue;
+		fly_sem_notrack_wait(&fly_sched.threadsem);
 	}
 	return param;
 }
 
+static inline void fly_sched_works_added(int nb)
+{
+	if (fly_sched.poll) {
+		fly_atomic_inc(&fly_sched.pending, nb);
+		fly_atomic_barrier();
+		if (fly_atomic_cas(&fly_sched.threadsleeping, 1, 0))
+			fly_sem_post(&fly_sched.threadsem);
+	}
+}
+
+static inline void fly_sched_work_added()
+{
+	fly_sched_works_added(1);
+}
+
+static inline void fly_sched_work_done()
+{
+	if (fly_sched.poll)
+		fly_atomic_dec(&fly_sched.pending, 1);
+}
+
 /******************************************************************************
  * Init/uninit interface
  *****************************************************************************/
@@ -87,14 +148,89 @@ void fly_set_nbworkers(int nb)
 	fly_sched.nbworkers = nb;
 }
 
+int fly_get_nbworkers()
+{
+	return fly_sched.nbworkers;
+}
+
+void fly_sched_set_poll(int poll)
+{
+	fly_sched.poll = poll;
+}
+
+void fly_sched_set_idle(int policy, int spinusec)
+{
+	fly_sched.idlepolicy = policy;
+	fly_sched.idlespin = spinusec;
+}
+
+void fly_sched_set_pin(int pin)
+{
+	fly_sched.pin = pin;
+}
+
+void fly_sched_set_numa(int nodes)
+{
+	fly_sched.simnodes = nodes;
+}
+
+void fly_sched_set_prio_aging(int usec)
+{
+	fly_sched.prioaging = usec;
+}
+
+int fly_sched_get_nbnodes()
+{
+	return fly_sched.nbnodes;
+}
+
+/* -1 if the workers are not grouped by the real nodes */
+int fly_sched_addr_node(const void *addr)
+{
+	if ((fly_sched.nbnodes < 2) || (fly_sched.simnodes > 0))
+		return -1;
+	return fly_topology_addr_node(&fly_sched.topo, addr);
+}
+
+/* the nodes are all -1 if the workers are not grouped by the real nodes */
+int fly_sched_addrs_nodes(const void **addrs, int *nodes, int count)
+{
+	int i;
+	if ((fly_sched.nbnodes < 2) || (fly_sched.simnodes > 0)) {
+		for (i = 0; i < count; i++)
+			nodes[i] = -1;
+		return FLYESUCCESS;
+	}
+	return fly_topology_addrs_nodes(&fly_sched.topo, addrs, nodes, count);
+}
+
+int fly_sched_worker_node(int worker)
+{
+	return fly_sched.workers[worker].node;
+}
+
+int fly_sem_spin = FLY_SEM_SPIN;
+
 int fly_sched_init()
 {
 	int err;
+	/* spinning only pays off when the poster runs on another CPU */
+	if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+		fly_sem_spin = FLY_SEM_SPIN;
+	} else {
+		fly_sem_spin = 0;
+		if (fly_sched.idlepolicy == FLY_IDLE_ADAPTIVE)
+			fly_sched.idlepolicy = FLY_IDLE_PARK;
+	}
 	fly_sched.initialized = 0;
 	fly_sched.thread = NULL;
+	fly_sched.completions = 0;
+	fly_sched.anywaiters = 0;
+	fly_sched.nbattached = 0;
 	err = fly_sched_init_locks();
 	if (FLY_SUCCEEDED(err)) {
 		fly_sched_init_lists();
+		fly_sched_init_pools();
 		err = fly_sched_workers_init();
 		if (FLY_SUCCEEDED(err)) {
 			err = fly_sched_thread_init();
@@ -102,10 +238,12 @@ int fly_sched_init()
 				fly_sched.initialized = 1;
 			} else {
 				fly_sched_workers_uninit(fly_sched.nbworkers);
-				fly_sched_uninit_locks(FLY_SCHED_TREE_LOCKS);
+				fly_sched_uninit_pools();
+				fly_sched_uninit_locks(FLY_SCHED_FOUR_LOCKS);
 			}
 		} else {
-			fly_sched_uninit_locks(FLY_SCHED_TREE_LOCKS);
+			fly_sched_uninit_pools();
+			fly_sched_uninit_locks(FLY_SCHED_FOUR_LOCKS);
 		}
 	}
 	return err;
@@ -114,10 +252,14 @@ int fly_sched_init()
 int fly_sched_uninit()
 {
 	int err = FLYESUCCESS;
+	fly_assert(fly_sched.nbattached == 0,
+			"fly_sched_uninit with attached threads left");
+	fly_sched.initialized = 0;
 	fly_sched_thread_uninit();
 	fly_sched_workers_uninit(fly_sched.nbworkers);
 	fly_sched_uninit_lists();
-	fly_sched_uninit_locks(FLY_SCHED_TREE_LOCKS);
+	fly_sched_uninit_pools();
+	fly_sched_uninit_locks(FLY_SCHED_FOUR_LOCKS);
 	return err;
 }
 
@@ -127,16 +269,15 @@ int fly_sched_uninit()
 int fly_sched_add_job(struct fly_job *job)
 {
 	int err = FLYENOIMP;
-	if ((job->jtype == FLY_TASK_PARALLEL_FOR) ||
-			(job->jtype == FLY_TASK_PARALLEL_FOR_ARR)) {
+	if (fly_sched_is_batched(job)) {
 		err = fly_sched_add_pfj(job);
 	} else if (job->jtype == FLY_TASK_TASK) {
-			err = fly_sched_add_to_ready(job);
+		job->state = FLY_JOB_READY;
+		err = fly_sched_add_to_ready(job);
 	}
 	if (FLY_SUCCEEDED(err)) {
-		int i;
-		for (i = 0; i < fly_sched.nbworkers; i++)
-			fly_worker_work_available(&fly_sched.workers[i]);
+		fly_sched_work_added();
+		fly_sched_wake(fly_job_parallelism(job), NULL);
 	}
 	return err;
 }
@@ -145,30 +286,103 @@ int fly_sched_add_job_from_worker(struct fly_job *job,
 		struct fly_worker_thread *wthread)
 {
 	int err = FLYESUCCESS;
-	if ((job->jtype == FLY_TASK_PARALLEL_FOR) ||
-			(job->jtype == FLY_TASK_PARALLEL_FOR_ARR)) {
+	if (fly_sched_is_batched(job)) {
 		err = fly_make_batches(job, fly_sched.nbworkers);
 		if (FLY_SUCCEEDED(err)) {
-			int i;
+			fly_sched_work_added();
 			fly_sched_move_to_running(job, &wthread->thread);
-			for (i = 0; i < fly_sched.nbworkers; i++) {
-				if (&fly_sched.workers[i] != wthread->parent)
-					fly_worker_work_available(&fly_sched.workers[i]);
-			}
+			/* the calling thread runs batches of the job too */
+			fly_sched_wake(fly_job_parallelism(job) - 1, wthread->parent);
 		} else {
-			if (!FLY_SUCCEEDED(err))
-				fly_destroy_batches(job);
+			fly_destroy_batches(job);
 		}
 	} else if (job->jtype == FLY_TASK_TASK) {
-		err = fly_sched_add_to_ready(job);
+		/* tasks from workers stay local, idle workers steal them */
+		job->state = FLY_JOB_READY;
+		fly_sched_work_added();
+		err = fly_deque_push(&wthread->deque, job);
+		if (FLY_SUCCEEDED(err))
+			fly_sched_wake(1, wthread->parent);
+		else
+			fly_sched_work_done();
 	}
 	return err;
 }
 
+/*
+ * A loop added by a thread which is not a worker. The caller counts as one
+ * more participant when the loop is split, the job goes straight to the
+ * running list, one worker less is woken and the caller runs batches like
+ * them until none is left to claim, then it only has to wait for the others.
+ */
+int fly_sched_add_job_and_run(struct fly_job *job)
+{
+	int node;
+	int err;
+	fly_assert(fly_sched_is_batched(job),
+			"fly_sched_add_job_and_run requires a loop job");
+	err = fly_make_batches(job, fly_sched.nbworkers + 1);
+	if (!FLY_SUCCEEDED(err)) {
+		fly_destroy_batches(job);
+		return err;
+	}
+	fly_sched_work_added();
+	fly_mrswlock_notrack_wlock(&fly_sched.running_lock);
+	job->state = FLY_JOB_RUNNING;
+	fly_sched_list_append(&fly_sched.running_jobs, job);
+	fly_mrswlock_wunlock(&fly_sched.running_lock);
+	fly_sched_wake(fly_job_parallelism(job) - 1, NULL);
+	node = fly_sched_caller_node();
+	do {
+		fly_atomic_inc(&job->users, 1);
+	} while ((fly_sched_exec_job_on(job, NULL, node) == 0) &&
+			!fly_job_is_done(job));
+	return FLYESUCCESS;
+}
+
+/*
+ * Task jobs added together, the sched_data of the tasks. A worker puts them
+ * on its own deque, anything else on the ready queues in one pass under the
+ * lock, then the idle workers are woken in one round.
+ */
+int fly_sched_add_tasks(struct fly_task **tasks, int nbtasks)
+{
+	struct fly_worker_thread *wthread = fly_sched_get_wthread();
+	struct fly_job *job;
+	long long now = 0;
+	int added = 0;
+	int i;
+	if (wthread) {
+		for (; added < nbtasks; added++) {
+			job = tasks[added]->sched_data;
+			job->state = FLY_JOB_READY;
+			if (!FLY_SUCCEEDED(fly_deque_push(&wthread->deque, job)))
+				break;
+		}
+	}
+	if (added < nbtasks) {
+		if (fly_sched.prioaging > 0)
+			now = fly_thread_time_usec();
+		fly_mrswlock_notrack_wlock(&fly_sched.ready_lock);
+		for (i = added; i < nbtasks; i++) {
+			job = tasks[i]->sched_data;
+			job->state = FLY_JOB_READY;
+			job->readytime = now;
+			fly_sched_list_append(&fly_sched.ready_jobs[job->prio], job);
+			fly_sched.readymask |= 1 << job->prio;
+		}
+		fly_mrswlock_wunlock(&fly_sched.ready_lock);
+	}
+	fly_sched_works_added(nbtasks);
+	fly_sched_wake(nbtasks, wthread ? wthread->parent : NULL);
+	return FLYESUCCESS;
+}
+
 int fly_sched_job_collected(struct fly_job *job)
 {
 	fly_mrswlock_notrack_wlock(&fly_sched.done_lock);
-	fly_list_remove(&fly_sched.done_jobs, job);
+	fly_list_remove_node(&fly_sched.done_jobs, &job->node);
+	job->state = FLY_JOB_COLLECTED;
 	fly_mrswlock_wunlock(&fly_sched.done_lock);
 	return FLYESUCCESS;
 }
@@ -179,8 +393,17 @@ int fly_sched_job_collected(struct fly_job *job)
 void fly_schedule(struct fly_worker_thread *wthread)
 {
 	struct fly_job *job = fly_sched_get_job(wthread);
-	if (!job || (fly_sched_exec_job(job) != 0))
-		fly_worker_thread_wait_work(wthread);
+	if (job && (fly_sched_exec_job(job, wthread) == 0))
+		return;
+	/*
+	 * Look once more after going idle - work added before this look is
+	 * found by it and work added after it wakes the thread.
+	 */
+	fly_worker_thread_set_idle(wthread);
+	job = fly_sched_get_job(wthread);
+	if (!job || (fly_sched_exec_job(job, wthread) != 0))
+		fly_sched_wait_work(wthread);
+	fly_worker_thread_set_busy(wthread);
 }
 
 void fly_schedule_for_job(struct fly_worker_thread *wt, struct fly_job *job)
@@ -188,7 +411,101 @@ void fly_schedule_for_job(struct fly_worker_thread *wt, struct fly_job *job)
 	fly_assert(job->recurse > 0, "fly_schedule_for_job requires recursive job");
 	fly_assert(job->jtype != FLY_TASK_TASK,
 			"fly_schedule_for_job does not support FLY_TASK_TASK jobs");
-	fly_sched_exec_job(job);
+	fly_atomic_inc(&job->users, 1);
+	fly_sched_exec_job(job, wt);
+}
+
+/*
+ * A worker which waits for a job runs one of the other jobs meanwhile. Returns
+ * 0 if it ran nothing, a loop may have no range left to claim, then the worker
+ * has to block.
+ */
+int fly_sched_help(struct fly_worker_thread *wthread)
+{
+	struct fly_job *job = fly_sched_get_job(wthread);
+	if (!job)
+		return 0;
+	return !fly_sched_exec_job(job, wthread);
+}
+
+/*
+ * An application thread joins as a worker of its own: its pushes go to its
+ * deque, which the workers rob, and its waits run other jobs.
+ */
+int fly_sched_attach()
+{
+	struct fly_worker *worker;
+	int err;
+	if (!fly_sched.initialized || fly_sched_get_wthread())
+		return FLYEATTR;
+	worker = fly_malloc(sizeof(struct fly_worker));
+	if (!worker)
+		return FLYENORES;
+	err = fly_worker_attach(worker, fly_sched_caller_node());
+	if (!FLY_SUCCEEDED(err)) {
+		fly_free(worker);
+		return err;
+	}
+	fly_mrswlock_notrack_wlock(&fly_sched.attach_lock);
+	if (fly_sched.nbattached < FLY_SCHED_MAX_ATTACHED)
+		fly_sched.attached[fly_sched.nbattached++] = worker;
+	else
+		err = FLYENORES;
+	fly_mrswlock_wunlock(&fly_sched.attach_lock);
+	if (!FLY_SUCCEEDED(err)) {
+		fly_worker_detach(worker);
+		fly_free(worker);
+	}
+	return err;
+}
+
+/*
+ * The jobs still on the deque run before the thread leaves, then the write
+ * lock waits out the thieves which may be looking at the deque.
+ */
+int fly_sched_detach()
+{
+	struct fly_worker_thread *wthread = fly_sched_get_wthread();
+	struct fly_worker *worker;
+	struct fly_job *job;
+	int i;
+	if (!wthread || !wthread->parent->attached)
+		return FLYEATTR;
+	worker = wthread->parent;
+	while ((job = fly_deque_pop(&wthread->deque)) != NULL) {
+		fly_sched_start_job(job, wthread);
+		fly_sched_exec_job(job, wthread);
+	}
+	fly_mrswlock_notrack_wlock(&fly_sched.attach_lock);
+	for (i = 0; i < fly_sched.nbattached; i++) {
+		if (fly_sched.attached[i] == worker) {
+			fly_sched.attached[i] = fly_sched.attached[--fly_sched.nbattached];
+			break;
+		}
+	}
+	fly_mrswlock_wunlock(&fly_sched.attach_lock);
+	fly_sched_collect_pools(wthread);
+	fly_worker_detach(worker);
+	fly_free(worker);
+	return FLYESUCCESS;
+}
+
+/*
+ * Nobody wakes the thread for new work, so it looks again after a short
+ * sleep while cond stays 0.
+ */
+#define FLY_SCHED_RUN_UNTIL_POLL_NS	50000
+
+int fly_sched_run_until(fly_run_until_func cond, void *arg)
+{
+	struct fly_worker_thread *wthread = fly_sched_get_wthread();
+	if (!wthread)
+		return FLYEATTR;
+	while (!cond(arg)) {
+		if (!fly_sched_help(wthread))
+			fly_thread_sleep(FLY_SCHED_RUN_UNTIL_POLL_NS);
+	}
+	return FLYESUCCESS;
 }
 
 void fly_sched_update()
@@ -198,16 +515,98 @@ void fly_sched_update()
 		fly_worker_update(&fly_sched.workers[i]);
 }
 
+/*
+ * Event count of the completed tasks. Read it, look for a completed task and
+ * wait with what was read if there is none - a task completed meanwhile
+ * changed the count and the wait returns at once.
+ */
+int fly_sched_get_completions()
+{
+	return fly_sched.completions;
+}
+
+void fly_sched_wait_completion(int seen)
+{
+	struct fly_worker_thread *wthread = fly_sched_blocking_begin();
+	fly_atomic_inc(&fly_sched.anywaiters, 1);
+	fly_futex_wait(&fly_sched.completions, seen);
+	fly_atomic_dec(&fly_sched.anywaiters, 1);
+	fly_sched_blocking_end(wthread);
+}
+
+/* workers and attached threads keep their worker thread in TLS */
 struct fly_worker_thread *fly_sched_get_wthread()
+{
+	return fly_worker_thread_self();
+}
+
+/*
+ * Blocking regions of the worker threads. The waits of libfly which may block
+ * a worker go through them too.
+ */
+struct fly_worker_thread *fly_sched_blocking_begin()
+{
+	struct fly_worker_thread *wthread = fly_sched_get_wthread();
+	if (wthread)
+		fly_worker_thread_block_begin(wthread);
+	return wthread;
+}
+
+void fly_sched_blocking_end(struct fly_worker_thread *wthread)
+{
+	if (wthread)
+		fly_worker_thread_block_end(wthread);
+}
+
+/******************************************************************************
+ * Object pools interface
+ *****************************************************************************/
+void *fly_sched_pool_get(int type)
+{
+	struct fly_worker_thread *wthread;
+	if (!fly_sched.initialized)
+		return NULL;
+	wthread = fly_sched_get_wthread();
+	if (wthread) {
+		struct fly_pool *pool = &wthread->pools[type];
+		if (!pool->head)
+			fly_shared_pool_refill(&fly_sched.pools[type], pool);
+		return fly_pool_get(pool);
+	}
+	return fly_shared_pool_get(&fly_sched.pools[type]);
+}
+
+int fly_sched_pool_put(int type, void *obj)
+{
+	struct fly_worker_thread *wthread;
+	if (!fly_sched.initialized)
+		return 0;
+	wthread = fly_sched_get_wthread();
+	if (wthread) {
+		struct fly_pool *pool = &wthread->pools[type];
+		fly_pool_put(pool, obj);
+		if (pool->count > FLY_POOL_MAX_LOCAL)
+			fly_shared_pool_spill(&fly_sched.pools[type], pool);
+		return 1;
+	}
+	return fly_shared_pool_put(&fly_sched.pools[type], obj);
+}
+
+/* the worker counters are read without locking - only for statistics */
+void fly_sched_pool_stats(int type, unsigned long *hits, unsigned long *misses)
 {
 	int i;
+	*hits = fly_sched.pools[type].pool.hits;
+	*misses = fly_sched.pools[type].pool.misses;
+	if (!fly_sched.initialized)
+		return;
 	for (i = 0; i < fly_sched.nbworkers; i++) {
-		struct fly_worker_thread *thread;
-		thread = fly_worker_get_curr_thread(&fly_sched.workers[i]);
-		if (thread)
-			return thread;
+		struct fly_worker *worker = &fly_sched.workers[i];
+		*hits += worker->mthread.pools[type].hits +
+			worker->bthread.pools[type].hits;
+		*misses += worker->mthread.pools[type].misses +
+			worker->bthread.pools[type].misses;
 	}
-	return NULL;
 }
 
 /******************************************************************************
@@ -226,7 +625,14 @@ static inline int fly_sched_init_locks()
 		if (err == 0) {
 			err = fly_mrswlock_init(&fly_sched.done_lock,
 					FLY_SCHED_MAX_RLOCK);
-			if (err != 0) {
+			if (err == 0) {
+				err = fly_mrswlock_init(&fly_sched.attach_lock,
+						FLY_SCHED_MAX_RLOCK);
+				if (err != 0) {
+					fly_sched_uninit_locks(FLY_SCHED_TREE_LOCKS);
+					err = FLYENORES;
+				}
+			} else {
 				fly_sched_uninit_locks(FLY_SCHED_TWO_LOCKS);
 				err = FLYENORES;
 			}
@@ -240,6 +646,8 @@ static inline int fly_sched_init_locks()
 
 static inline void fly_sched_uninit_locks(int nb)
 {
+	if (nb >= FLY_SCHED_FOUR_LOCKS)
+		fly_mrswlock_uninit(&fly_sched.attach_lock);
 	if (nb >= FLY_SCHED_TREE_LOCKS)
 		fly_mrswlock_uninit(&fly_sched.done_lock);
 	if (nb >= FLY_SCHED_TWO_LOCKS)
@@ -250,36 +658,47 @@ static inline void fly_sched_uninit_locks(int nb)
 
 static inline void fly_sched_init_lists()
 {
-	fly_list_init(&fly_sched.ready_jobs);
+	int i;
+	for (i = 0; i < FLY_PRIO_NB_LEVELS; i++)
+		fly_list_init(&fly_sched.ready_jobs[i]);
+	fly_sched.readymask = 0;
 	fly_list_init(&fly_sched.running_jobs);
 	fly_list_init(&fly_sched.done_jobs);
 }
 
 static inline void fly_sched_uninit_lists()
 {
-	while (!fly_list_is_empty(&fly_sched.ready_jobs)) {
-		void *el = fly_list_tail(&fly_sched.ready_jobs)->el;
-		fly_list_remove(&fly_sched.ready_jobs, el);
-	}
-	while (!fly_list_is_empty(&fly_sched.running_jobs)) {
-		void *el = fly_list_tail(&fly_sched.running_jobs)->el;
-		fly_list_remove(&fly_sched.running_jobs, el);
-	}
-	while (!fly_list_is_empty(&fly_sched.done_jobs)) {
-		void *el = fly_list_tail(&fly_sched.done_jobs)->el;
-		fly_list_remove(&fly_sched.done_jobs, el);
+	int i;
+	/* the nodes are part of the jobs - just unlink them */
+	for (i = 0; i < FLY_PRIO_NB_LEVELS; i++) {
+		while (fly_list_tail_remove_node(&fly_sched.ready_jobs[i]))
+			;
 	}
+	while (fly_list_tail_remove_node(&fly_sched.running_jobs))
+		;
+	while (fly_list_tail_remove_node(&fly_sched.done_jobs))
+		;
 }
 
 static inline int fly_sched_thread_init()
 {
 	int err;
+	fly_sched.pending = 0;
+	fly_sched.threadsleeping = 0;
+	if (!fly_sched.poll)
+		return FLYESUCCESS;
+	if (fly_sem_init(&fly_sched.threadsem) != 0)
+		return FLYELLLIB;
 	fly_sched.thread = fly_malloc(sizeof(struct fly_thread));
-	if (!fly_sched.thread)
+	if (!fly_sched.thread) {
+		fly_sem_uninit(&fly_sched.threadsem);
 		return FLYENORES;
+	}
 	err = fly_thread_init(fly_sched.thread, fly_sched_thread_func, &fly_sched);
 	if (!FLY_SUCCEEDED(err)) {
 		fly_free(fly_sched.thread);
+		fly_sched.thread = NULL;
+		fly_sem_uninit(&fly_sched.threadsem);
 		return err;
 	}
 	fly_sched.threadstate = FLY_SCHED_THREAD_IDLE;
@@ -288,6 +707,7 @@ static inline int fly_sched_thread_init()
 		fly_thread_uninit(fly_sched.thread);
 		fly_free(fly_sched.thread);
 		fly_sched.thread = NULL;
+		fly_sem_uninit(&fly_sched.threadsem);
 		return err;
 	}
 	while (fly_sched.threadstate != FLY_SCHED_THREAD_RUNNING)
@@ -300,17 +720,43 @@ static inline int fly_sched_thread_uninit()
 	int err = FLYESUCCESS;
 	if (fly_sched.thread) {
 		fly_sched.threadstate = FLY_SCHED_THREAD_STOPPING;
+		fly_sem_post(&fly_sched.threadsem);
 		fly_thread_wait(fly_sched.thread);
 		err = fly_thread_uninit(fly_sched.thread);
 		fly_free(fly_sched.thread);
+		fly_sched.thread = NULL;
+		fly_sem_uninit(&fly_sched.threadsem);
 	}
 	return err;
 }
 
+/*
+ * Workers are grouped by NUMA node only when they are pinned - unpinned ones
+ * move between the nodes. Simulated nodes take consecutive workers.
+ */
+static inline int fly_sched_worker_init_node(int worker)
+{
+	if (fly_sched.simnodes > 0)
+		return (worker * fly_sched.nbnodes) / fly_sched.nbworkers;
+	if (fly_sched.nbnodes > 1)
+		return fly_topology_worker_node(&fly_sched.topo, worker);
+	return 0;
+}
+
 static inline int fly_sched_workers_init()
 {
 	int err = FLYESUCCESS;
 	int nbworkers = fly_sched.nbworkers;
+	struct fly_topology *topo = &fly_sched.topo;
+	err = fly_topology_init(topo);
+	if (!FLY_SUCCEEDED(err))
+		return err;
+	fly_sched.nbnodes = 1;
+	if (fly_sched.simnodes > 0)
+		fly_sched.nbnodes = (fly_sched.simnodes < nbworkers) ?
+			fly_sched.simnodes : nbworkers;
+	else if (fly_sched.pin)
+		fly_sched.nbnodes = topo->nbnodes;
 	fly_sched.workers = fly_malloc(sizeof(struct fly_worker) * nbworkers);
 	if (fly_sched.workers) {
 		int i;
@@ -318,16 +764,29 @@ static inline int fly_sched_workers_init()
 			err = fly_worker_init(&fly_sched.workers[i]);
 			if (!FLY_SUCCEEDED(err))
 				break;
-			err = fly_worker_start(&fly_sched.workers[i]);
-			if (!FLY_SUCCEEDED(err)) {
-				fly_worker_uninit(&fly_sched.workers[i]);
-				break;
+			fly_sched.workers[i].node = fly_sched_worker_init_node(i);
+			if (fly_sched.pin) {
+				int cpu = fly_topology_worker_cpu(topo, i);
+				err = fly_worker_set_cpu(&fly_sched.workers[i], cpu);
+				if (!FLY_SUCCEEDED(err)) {
+					fly_worker_uninit(&fly_sched.workers[i]);
+					break;
+				}
 			}
 		}
-		if (i != nbworkers) {
-			fly_sched_workers_uninit(i);
+		/* started workers steal from and wake the others - all must be ready */
+		if (i == nbworkers) {
+			int j;
+			for (j = 0; j < nbworkers; j++) {
+				err = fly_worker_start(&fly_sched.workers[j]);
+				if (!FLY_SUCCEEDED(err))
+					break;
+			}
 		}
+		if (!FLY_SUCCEEDED(err))
+			fly_sched_workers_uninit(i);
 	} else {
+		fly_topology_uninit(topo);
 		err = FLYENORES;
 	}
 	return err;
@@ -337,22 +796,61 @@ static inline int fly_sched_workers_uninit(int nbworkers)
 {
 	int err = FLYESUCCESS;
 	int i;
+	/* every worker stops before any deque is freed - they rob each other */
 	for (i = 0; i < nbworkers; i++)
+		fly_worker_request_exit(&fly_sched.workers[i]);
+	for (i = 0; i < nbworkers; i++)
+		err |= fly_worker_wait(&fly_sched.workers[i]);
+	for (i = 0; i < nbworkers; i++) {
 		err |= fly_worker_uninit(&fly_sched.workers[i]);
+		fly_sched_collect_pools(&fly_sched.workers[i].mthread);
+		fly_sched_collect_pools(&fly_sched.workers[i].bthread);
+	}
 	fly_free(fly_sched.workers);
+	fly_topology_uninit(&fly_sched.topo);
 	return err;
 }
 
+static inline void fly_sched_init_pools()
+{
+	int i;
+	for (i = 0; i < FLY_POOL_NB_TYPES; i++)
+		fly_shared_pool_init(&fly_sched.pools[i]);
+}
+
+static inline void fly_sched_uninit_pools()
+{
+	fly_shared_pool_uninit(&fly_sched.pools[FLY_POOL_JOB], fly_job_release);
+	fly_shared_pool_uninit(&fly_sched.pools[FLY_POOL_TASK], fly_free);
+}
+
+/* stopped or detached threads - their objects go to the shared pools */
+static inline void fly_sched_collect_pools(struct fly_worker_thread *wthread)
+{
+	int i;
+	for (i = 0; i < FLY_POOL_NB_TYPES; i++)
+		fly_shared_pool_collect(&fly_sched.pools[i], &wthread->pools[i]);
+}
+
 /******************************************************************************
  * Job helper functions implementations
  *****************************************************************************/
+static inline void fly_sched_list_append(struct fly_list *list,
+		struct fly_job *job)
+{
+	fly_list_init_with_el(&job->node, job);
+	fly_list_append_node(list, &job->node);
+}
+
 static inline int fly_sched_add_to_ready(struct fly_job *job)
 {
-	int err;
+	if (fly_sched.prioaging > 0)
+		job->readytime = fly_thread_time_usec();
 	fly_mrswlock_notrack_wlock(&fly_sched.ready_lock);
-	err = fly_list_append(&fly_sched.ready_jobs, job);
+	fly_sched_list_append(&fly_sched.ready_jobs[job->prio], job);
+	fly_sched.readymask |= 1 << job->prio;
 	fly_mrswlock_wunlock(&fly_sched.ready_lock);
-	return err;
+	return FLYESUCCESS;
 }
 
 static int fly_sched_add_pfj(struct fly_job *job)
@@ -369,56 +867,157 @@ static int fly_sched_add_pfj(struct fly_job *job)
 /******************************************************************************
  * Scheduling helper functions implementations
  *****************************************************************************/
-static int fly_pfarrj_exec(struct fly_job *job)
+/*
+ * With FLY_PFOR_ADAPTIVE the thread keeps its split and runs chunks from it
+ * until there is nothing left to split.
+ */
+static int fly_pfarrj_exec(struct fly_job *job, int node, int *done)
 {
-	struct fly_job_batch *batch = fly_get_exec_batch(job);
-	if (batch) {
+	struct fly_job_split *split = NULL;
+	int shouldsleep = 1;
+	int start;
+	int end;
+	while (fly_job_claim_range(job, node, &split, &start, &end)) {
 		int i;
-		int count = batch->end - batch->start;
-		char *data = (char*)batch->job->data;
-		char *param = data + (batch->start * batch->job->elsize);
-
-		for (i = 0; i < count; i++) {
-			job->func.pfor(batch->start + i, param);
-			param += batch->job->elsize;
+		char *param = (char*)job->data + (start * job->elsize);
+		for (i = start; i < end; i++) {
+			job->func.pfor(i, param);
+			param += job->elsize;
 		}
-		fly_atomic_inc(&job->batches_done, 1);
-		return 0;
+		*done = fly_job_range_done(job, start, end);
+		shouldsleep = 0;
+		if (!split)
+			break;
 	}
-	return 1;
+	return shouldsleep;
 }
 
-static int fly_pfptrj_exec(struct fly_job *job)
+static int fly_pfptrj_exec(struct fly_job *job, int node, int *done)
 {
-	struct fly_job_batch *batch = fly_get_exec_batch(job);
-	if (batch) {
+	struct fly_job_split *split = NULL;
+	int shouldsleep = 1;
+	int start;
+	int end;
+	while (fly_job_claim_range(job, node, &split, &start, &end)) {
 		int i;
-		int count = batch->end - batch->start;
-		for (i = 0; i < count; i++) {
-			job->func.pfor(batch->start + i, job->data);
+		for (i = start; i < end; i++) {
+			job->func.pfor(i, job->data);
 		}
-		fly_atomic_inc(&job->batches_done, 1);
-		return 0;
+		*done = fly_job_range_done(job, start, end);
+		shouldsleep = 0;
+		if (!split)
+			break;
 	}
-	return 1;
+	return shouldsleep;
+}
+
+static int fly_prarrj_exec(struct fly_job *job, int node, int *done)
+{
+	struct fly_job_split *split = NULL;
+	int shouldsleep = 1;
+	int start;
+	int end;
+	while (fly_job_claim_range(job, node, &split, &start, &end)) {
+		char *data = (char*)job->data;
+		job->func.prange(start, end, data + (start * job->elsize));
+		*done = fly_job_range_done(job, start, end);
+		shouldsleep = 0;
+		if (!split)
+			break;
+	}
+	return shouldsleep;
+}
+
+static int fly_prptrj_exec(struct fly_job *job, int node, int *done)
+{
+	struct fly_job_split *split = NULL;
+	int shouldsleep = 1;
+	int start;
+	int end;
+	while (fly_job_claim_range(job, node, &split, &start, &end)) {
+		job->func.prange(start, end, job->data);
+		*done = fly_job_range_done(job, start, end);
+		shouldsleep = 0;
+		if (!split)
+			break;
+	}
+	return shouldsleep;
 }
 
 static int fly_taskjob_exec(struct fly_job *job)
 {
 	struct fly_task *task = job->data;
-	task->result = task->func(task->param);
+	/* tasks of a cancelled group which did not start are skipped */
+	if (job->group && job->group->cancelled)
+		task->result = NULL;
+	else
+		task->result = task->func(task->param);
+	job->batches_done = job->nbbatches;
 	return 0;
 }
 
-static struct fly_job *fly_sched_get_ready(struct fly_thread *t)
+/*
+ * Called with ready_lock - the oldest job if it waited past prioaging. The
+ * heads of the lists are their oldest jobs.
+ */
+static struct fly_list *fly_sched_get_aged()
 {
-	struct fly_job *job;
+	long long oldest = fly_thread_time_usec() - fly_sched.prioaging;
+	struct fly_list *aged = NULL;
+	int agedprio = 0;
+	int prio;
+	for (prio = 0; prio < FLY_PRIO_NB_LEVELS; prio++) {
+		struct fly_list *head = fly_list_head(&fly_sched.ready_jobs[prio]);
+		struct fly_job *job;
+		if (!head)
+			continue;
+		job = head->el;
+		if (job->readytime <= oldest) {
+			oldest = job->readytime;
+			aged = head;
+			agedprio = prio;
+		}
+	}
+	if (aged)
+		fly_list_remove_node(&fly_sched.ready_jobs[agedprio], aged);
+	return aged;
+}
+
+/*
+ * The newest job of the highest non-empty level down to maxprio, or the
+ * oldest job of any level which waited past prioaging. readymask is read
+ * without the lock first, a job added after that wakes the thread.
+ */
+static struct fly_job *fly_sched_get_ready(struct fly_thread *t, int maxprio)
+{
+	unsigned int levels = (2u << maxprio) - 1;
+	struct fly_list *node = NULL;
+	int prio;
+	if (!(fly_sched.readymask & levels) &&
+			!(fly_sched.readymask && (fly_sched.prioaging > 0)))
+		return NULL;
 	fly_mrswlock_wlock(&fly_sched.ready_lock, t);
-	job = fly_list_tail_remove(&fly_sched.ready_jobs);
+	if (fly_sched.readymask) {
+		if (fly_sched.prioaging > 0)
+			node = fly_sched_get_aged();
+		if (!node && (fly_sched.readymask & levels)) {
+			prio = __builtin_ctz(fly_sched.readymask & levels);
+			node = fly_list_tail_remove_node(&fly_sched.ready_jobs[prio]);
+		}
+	}
+	if (node) {
+		prio = ((struct fly_job*)node->el)->prio;
+		if (fly_list_is_empty(&fly_sched.ready_jobs[prio]))
+			fly_sched.readymask &= ~(1 << prio);
+	}
 	fly_mrswlock_wunlock(&fly_sched.ready_lock);
-	return job;
+	return node ? node->el : NULL;
 }
 
+/*
+ * Loops whose ranges are all claimed are skipped - they only wait for the
+ * threads running them, the caller steals or takes a low task instead.
+ */
 static struct fly_job *fly_sched_get_running(struct fly_thread *t)
 {
 	struct fly_job *job = NULL;
@@ -427,13 +1026,16 @@ static struct fly_job *fly_sched_get_running(struct fly_thread *t)
 	curr = fly_list_head(&fly_sched.running_jobs);
 	while (curr) {
 		job = curr->el;
-		if (job->batches_done == job->nbbatches) {
+		if (!fly_job_has_work(job)) {
+			job = NULL;
 			curr = curr->next;
 			continue;
 		}
 		else
 			break;
 	}
+	if (job)
+		fly_atomic_inc(&job->users, 1);
 	fly_mrswlock_runlock(&fly_sched.running_lock);
 	return job;
 }
@@ -442,69 +1044,258 @@ static void fly_sched_move_to_running(struct fly_job *job, struct fly_thread *t)
 {
 	fly_mrswlock_wlock(&fly_sched.running_lock, t);
 	job->state = FLY_JOB_RUNNING;
-	fly_list_append(&fly_sched.running_jobs, job);
+	fly_sched_list_append(&fly_sched.running_jobs, job);
 	fly_mrswlock_wunlock(&fly_sched.running_lock);
 }
 
 static void fly_sched_remove_running(struct fly_job *job)
 {
 	fly_mrswlock_notrack_wlock(&fly_sched.running_lock);
-	fly_list_remove(&fly_sched.running_jobs, job);
+	fly_list_remove_node(&fly_sched.running_jobs, &job->node);
 	fly_mrswlock_wunlock(&fly_sched.running_lock);
 }
 
 static void fly_sched_move_to_done(struct fly_job *job)
 {
 	fly_mrswlock_notrack_wlock(&fly_sched.done_lock);
-	fly_list_append(&fly_sched.done_jobs, job);
+	fly_sched_list_append(&fly_sched.done_jobs, job);
 	fly_mrswlock_wunlock(&fly_sched.done_lock);
 }
 
+/* the threads of the own node are robbed first */
+static struct fly_job *fly_sched_steal(struct fly_worker_thread *wthread)
+{
+	int nbthreads = fly_sched.nbworkers * FLY_WORKER_NB_THREADS;
+	int nbpasses = (fly_sched.nbnodes > 1) ? 2 : 1;
+	int node = wthread->parent->node;
+	unsigned int seed = wthread->seed;
+	struct fly_job *job;
+	int pass;
+	int i;
+	int victim;
+
+	/* xorshift - only to spread the thieves over the victims */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	wthread->seed = seed;
+
+	victim = seed % nbthreads;
+	for (pass = 0; pass < nbpasses; pass++) {
+		for (i = 0; i < nbthreads; i++) {
+			int w = victim / FLY_WORKER_NB_THREADS;
+			struct fly_worker_thread *vt = &fly_sched.workers[w].mthread;
+			if (victim % FLY_WORKER_NB_THREADS)
+				vt = &fly_sched.workers[w].bthread;
+			if (++victim == nbthreads)
+				victim = 0;
+			if (vt == wthread)
+				continue;
+			if ((nbpasses > 1) && ((fly_sched.workers[w].node == node) == pass))
+				continue;
+			job = fly_deque_steal(&vt->deque);
+			if (job)
+				return job;
+		}
+	}
+	if (fly_sched.nbattached > 0)
+		return fly_sched_steal_attached(wthread);
+	return NULL;
+}
+
+/* the lock keeps the deques of the attached threads until the steal is over */
+static struct fly_job *fly_sched_steal_attached(
+		struct fly_worker_thread *wthread)
+{
+	struct fly_job *job = NULL;
+	int i;
+	fly_mrswlock_notrack_rlock(&fly_sched.attach_lock);
+	for (i = 0; !job && (i < fly_sched.nbattached); i++) {
+		struct fly_worker_thread *vt = &fly_sched.attached[i]->mthread;
+		if (vt != wthread)
+			job = fly_deque_steal(&vt->deque);
+	}
+	fly_mrswlock_runlock(&fly_sched.attach_lock);
+	return job;
+}
+
+static void fly_sched_start_job(struct fly_job *job,
+		struct fly_worker_thread *wthread)
+{
+	fly_atomic_inc(&job->users, 1);
+	if (fly_sched_is_batched(job)) {
+		fly_sched_move_to_running(job, &wthread->thread);
+	} else if (job->jtype == FLY_TASK_TASK) {
+		/* only the thread which took the task runs it - no running list */
+		job->state = FLY_JOB_RUNNING;
+	} else {
+		fly_assert(0, "fly_schedule unsupported job type");
+	}
+}
+
 static struct fly_job *fly_sched_get_job(struct fly_worker_thread *wthread)
 {
-	struct fly_job *job = fly_sched_get_ready(&wthread->thread);
+	struct fly_job *job = NULL;
+	/* urgent tasks go before the own deque */
+	if (fly_sched.readymask & (1 << FLY_PRIO_HIGH))
+		job = fly_sched_get_ready(&wthread->thread, FLY_PRIO_HIGH);
+	if (!job)
+		job = fly_deque_pop(&wthread->deque);
+	if (!job)
+		job = fly_sched_get_ready(&wthread->thread, FLY_PRIO_NORMAL);
 	if (job) {
-		if ((job->jtype == FLY_TASK_PARALLEL_FOR) ||
-				(job->jtype == FLY_TASK_PARALLEL_FOR_ARR)) {
-			int i;
-			fly_sched_move_to_running(job, &wthread->thread);
-			for (i = 0; i < fly_sched.nbworkers; i++) {
-				if (&fly_sched.workers[i] != wthread->parent)
-					fly_worker_work_available(&fly_sched.workers[i]);
-			}
-		} else if (job->jtype == FLY_TASK_TASK) {
-			/* prevents other threads to get this job as running */
-			job->batches_done = job->nbbatches;
-			fly_sched_move_to_running(job, &wthread->thread);
-		} else {
-			fly_assert(0, "fly_schedule unsupported job type");
-		}
+		fly_sched_start_job(job, wthread);
 	} else {
 		job = fly_sched_get_running(&wthread->thread);
+		if (!job) {
+			job = fly_sched_steal(wthread);
+			/* background tasks only when there is nothing else */
+			if (!job)
+				job = fly_sched_get_ready(&wthread->thread, FLY_PRIO_LOW);
+			if (job)
+				fly_sched_start_job(job, wthread);
+		}
 	}
 	return job;
 }
 
-static int fly_sched_exec_job(struct fly_job *job)
+/* a thread which is not a worker claims for the node of its own stack */
+static inline int fly_sched_caller_node()
+{
+	int onstack = 0;
+	int node = fly_sched_addr_node(&onstack);
+	return (node < 0) ? 0 : node;
+}
+
+/*
+ * wthread is NULL for the loops run by their caller, node is the one the
+ * ranges are claimed for.
+ */
+static int fly_sched_exec_job_on(struct fly_job *job,
+		struct fly_worker_thread *wthread, int node)
 {
 	int shouldsleep;
+	int done = 0;
 
 	if (job->jtype == FLY_TASK_PARALLEL_FOR) {
-		shouldsleep = fly_pfptrj_exec(job);
+		shouldsleep = fly_pfptrj_exec(job, node, &done);
 	} else if (job->jtype == FLY_TASK_PARALLEL_FOR_ARR) {
-		shouldsleep = fly_pfarrj_exec(job);
+		shouldsleep = fly_pfarrj_exec(job, node, &done);
+	} else if (job->jtype == FLY_TASK_PARALLEL_RANGE) {
+		shouldsleep = fly_prptrj_exec(job, node, &done);
+	} else if (job->jtype == FLY_TASK_PARALLEL_RANGE_ARR) {
+		shouldsleep = fly_prarrj_exec(job, node, &done);
 	} else if (job->jtype == FLY_TASK_TASK) {
 		shouldsleep = fly_taskjob_exec(job);
+		done = 1;
 	} else {
 		fly_assert(0, "[fly_sched] unsupported job type");
 		shouldsleep = 1;
 	}
 
-	if (fly_job_is_done(job)) {
+	/* only the thread which finished the last batch completes the job */
+	if (done) {
+		if (fly_sched_is_batched(job))
+			fly_sched_remove_running(job);
+		else
+			fly_sched_task_done(job, wthread);
+		if (job->group) {
+			/* nobody waits for the job itself */
+			fly_sched_work_done();
+			fly_atomic_dec(&job->users, 1);
+			fly_job_group_done(job);
+			return shouldsleep;
+		}
 		job->state = FLY_JOB_DONE;
-		fly_sched_remove_running(job);
 		fly_sched_move_to_done(job);
-		fly_sem_post(&job->sem);
+		fly_sched_work_done();
 	}
+	/* the waiter may free the job once users is 0 - the post goes first */
+	if (done)
+		fly_sem_post(&job->sem);
+	fly_atomic_dec(&job->users, 1);
 	return shouldsleep;
 }
+
+static inline int fly_sched_exec_job(struct fly_job *job,
+		struct fly_worker_thread *wthread)
+{
+	return fly_sched_exec_job_on(job, wthread, wthread->parent->node);
+}
+
+/*
+ * A task completed. Successors whose last dependency was job go where
+ * fly_push_task_prio puts their level - normal ones to the deque of the
+ * thread, which is likely to have their input in its caches, the others to
+ * the ready queue of their level. Then the waiters for any task and the queue
+ * of the task are told.
+ */
+static void fly_sched_task_done(struct fly_job *job,
+		struct fly_worker_thread *wthread)
+{
+	struct fly_job_edge *edge = fly_job_close_succs(job);
+	while (edge) {
+		struct fly_job *succ = edge->succ;
+		/* the edge belongs to succ, which may run as soon as it is added */
+		edge = edge->next;
+		if (fly_atomic_dec(&succ->deps, 1) != 0)
+			continue;
+		if ((succ->prio != FLY_PRIO_NORMAL) ||
+				!FLY_SUCCEEDED(fly_sched_add_job_from_worker(succ, wthread)))
+			fly_sched_add_job(succ);
+	}
+	if (job->queue)
+		fly_job_queue_push(job->queue, job);
+	/* the count is raised before anywaiters is read, see wait_completion */
+	fly_atomic_inc(&fly_sched.completions, 1);
+	if (fly_sched.anywaiters > 0)
+		fly_futex_wake(&fly_sched.completions, INT_MAX);
+}
+
+/*
+ * Wake up to nb idle workers other than self. Busy workers look for more work
+ * before they sleep, so they need no post. The scan starts from a different
+ * worker each time to spread the work.
+ */
+static void fly_sched_wake(int nb, struct fly_worker *self)
+{
+	int first;
+	int i;
+	if (nb <= 0)
+		return;
+	/* the added work must be visible before the idle flags are read */
+	fly_atomic_barrier();
+	first = fly_atomic_inc(&fly_sched.nextwake, 1) % fly_sched.nbworkers;
+	for (i = 0; (i < fly_sched.nbworkers) && (nb > 0); i++) {
+		struct fly_worker *worker;
+		worker = &fly_sched.workers[(first + i) % fly_sched.nbworkers];
+		if ((worker != self) && fly_worker_wake_idle(worker))
+			nb--;
+	}
+}
+
+/*
+ * FLY_IDLE_ADAPTIVE keeps a running average of how long the thread waited for
+ * work and spins only while the average stays under the spin budget.
+ */
+#define FLY_SCHED_MAX_IDLE_US	1000000
+
+static void fly_sched_wait_work(struct fly_worker_thread *wthread)
+{
+	long long start;
+	long long waited;
+	int spin = fly_sched.idlespin;
+	if (fly_sched.idlepolicy == FLY_IDLE_PARK) {
+		fly_worker_thread_wait_work(wthread, 0);
+	} else if (fly_sched.idlepolicy == FLY_IDLE_SPIN) {
+		fly_worker_thread_wait_work(wthread, spin);
+	} else {
+		start = fly_thread_time_usec();
+		fly_worker_thread_wait_work(wthread,
+				(wthread->idleavg < spin) ? spin : 0);
+		waited = fly_thread_time_usec() - start;
+		if (waited > FLY_SCHED_MAX_IDLE_US)
+			waited = FLY_SCHED_MAX_IDLE_US;
+		wthread->idleavg += ((int)waited - wthread->idleavg) / 4;
+	}
+}
@@ -22,16 +22,21 @@
 #ifndef FLY_SCHEDULER_H
 #define FLY_SCHEDULER_H
 
+#include <libfly/fly.h>
 #include <libfly/fly_error.h>
 
 #include "fly_mrswlock.h"
 #include "fly_list.h"
+#include "fly_pool.h"
+#include "fly_sem.h"
+#include "fly_topology.h"
 
 /* Forwards */
 struct fly_worker;
 struct fly_worker_thread;
 struct fly_job;
 struct fly_thread;
+struct fly_task;
 
 /*****************************************************************************
  * Supported job/task types
@@ -39,6 +44,10 @@ struct fly_thread;
 #define FLY_TASK_PARALLEL_FOR		1
 #define FLY_TASK_PARALLEL_FOR_ARR	2
 #define FLY_TASK_TASK				3
+#define FLY_TASK_PARALLEL_RANGE		4
+#define FLY_TASK_PARALLEL_RANGE_ARR	5
+
+#define FLY_SCHED_MAX_ATTACHED		64
 
 #define FLY_SCHED_THREAD_IDLE		0
 #define FLY_SCHED_THREAD_RUNNING	1
@@ -48,8 +57,12 @@ struct fly_sched {
 	struct fly_worker		*workers;
 	int						nbworkers;
 	int						initialized;
+	volatile unsigned int	nextwake; /* first worker fly_sched_wake tries */
 
-	struct fly_list			ready_jobs;
+	/* a list per fly_task_prio, readymask has a bit for the non-empty ones */
+	struct fly_list			ready_jobs[FLY_PRIO_NB_LEVELS];
+	volatile unsigned int	readymask;
+	int						prioaging;
 	struct fly_list			running_jobs;
 	struct fly_list			done_jobs;
 
@@ -57,12 +70,50 @@ struct fly_sched {
 	struct fly_mrswlock		running_lock;
 	struct fly_mrswlock		done_lock;
 
+	/* released jobs and tasks of threads which are not workers */
+	struct fly_shared_pool	pools[FLY_POOL_NB_TYPES];
+
+	/* optional /proc polling for blocked threads, see fly_config */
 	struct fly_thread		*thread;
 	int						threadstate;
+	int						poll;
+	volatile int			pending;
+	volatile int			threadsleeping;
+	struct fly_sem			threadsem;
+
+	/* what idle workers do, see fly_idle_policy */
+	int						idlepolicy;
+	int						idlespin;
+
+	/* pin every worker to its own core, see fly_topology */
+	int						pin;
+
+	/* completed tasks, fly_wait_any sleeps on the count */
+	volatile int			completions;
+	volatile int			anywaiters;
+
+	/* NUMA node groups of the workers, simnodes > 0 fakes the topology */
+	struct fly_topology		topo;
+	int						simnodes;
+	int						nbnodes;
+
+	/* application threads taking part, thieves read them under attach_lock */
+	struct fly_worker		*attached[FLY_SCHED_MAX_ATTACHED];
+	volatile int			nbattached;
+	struct fly_mrswlock		attach_lock;
 }; /* fly_sched */
 
 void fly_set_nbworkers(int nb);
 int fly_get_nbworkers();
+void fly_sched_set_poll(int poll);
+void fly_sched_set_idle(int policy, int spinusec);
+void fly_sched_set_pin(int pin);
+void fly_sched_set_numa(int nodes);
+void fly_sched_set_prio_aging(int usec);
+int fly_sched_get_nbnodes();
+int fly_sched_addr_node(const void *addr);
+int fly_sched_addrs_nodes(const void **addrs, int *nodes, int count);
+int fly_sched_worker_node(int worker);
 
 int fly_sched_init();
 int fly_sched_uninit();
@@ -70,11 +121,26 @@ int fly_sched_uninit();
 int fly_sched_add_job(struct fly_job *job);
 int fly_sched_add_job_from_worker(struct fly_job *job,
 		struct fly_worker_thread *thread);
+int fly_sched_add_tasks(struct fly_task **tasks, int nbtasks);
+int fly_sched_add_job_and_run(struct fly_job *job);
 int fly_sched_job_collected(struct fly_job *job);
 
 void fly_schedule(struct fly_worker_thread *wthread);
 void fly_schedule_for_job(struct fly_worker_thread *wt, struct fly_job *job);
+int fly_sched_help(struct fly_worker_thread *wthread);
+int fly_sched_attach();
+int fly_sched_detach();
+int fly_sched_run_until(fly_run_until_func cond, void *arg);
 void fly_sched_update();
+int fly_sched_get_completions();
+void fly_sched_wait_completion(int seen);
 struct fly_worker_thread *fly_sched_get_wthread();
+struct fly_worker_thread *fly_sched_blocking_begin();
+void fly_sched_blocking_end(struct fly_worker_thread *wthread);
+
+void *fly_sched_pool_get(int type);
+int fly_sched_pool_put(int type, void *obj);
+void fly_sched_pool_stats(int type, unsigned long *hits,
+		unsigned long *misses);
 
 #endif /* FLY_SCHEDULER_H */
@@ -19,44 +19,133 @@
  * along with libfly. If not, see <http://www.gnu.org/licenses/>.
  *****************************************************************************/
 
+/*
+ * Counting semaphore on top of futex. The count and the number of parked
+ * waiters live in user space, so posting while nobody sleeps and waiting on
+ * a positive count never enter the kernel. Waiters spin fly_sem_spin times
+ * before they park.
+ */
+
 #ifndef LIBFLY_FLY_SEM_H
 #define LIBFLY_FLY_SEM_H
 
 #include "fly_thread.h"
+#include "fly_atomic.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
 
-#include <semaphore.h>
+#define FLY_SEM_SPIN	100
+
+/* set by fly_sched_init - 0 on single CPU machines */
+extern int fly_sem_spin;
 
 struct fly_sem {
-	sem_t	sem;
+	volatile int	count;
+	volatile int	nbwaiting;
 }; /* struct fly_sem */
 
+static inline void fly_futex_wait(volatile int *addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/* returns -1 if usec passed without a wake */
+static inline int fly_futex_timed_wait(volatile int *addr, int val, long usec)
+{
+	struct timespec ts;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static inline void fly_futex_wake(volatile int *addr, int nb)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nb, NULL, NULL, 0);
+}
+
 static inline int fly_sem_init(struct fly_sem *sem)
 {
-	return sem_init(&sem->sem, 0, 0);
+	sem->count = 0;
+	sem->nbwaiting = 0;
+	return 0;
 }
 
 static inline int fly_sem_uninit(struct fly_sem *sem)
 {
-	return sem_destroy(&sem->sem);
+	return 0;
+}
+
+static inline int fly_sem_trywait(struct fly_sem *sem)
+{
+	int count = sem->count;
+	while (count > 0) {
+		if (fly_atomic_cas(&sem->count, count, count - 1))
+			return 0;
+		count = sem->count;
+	}
+	return -1;
+}
+
+/* waits in the kernel until the count is positive and takes one */
+static inline void fly_sem_park(struct fly_sem *sem)
+{
+	/*
+	 * nbwaiting is raised before the count is checked again and the post
+	 * raises the count before it checks nbwaiting, so one of them sees
+	 * the other. A post between the check and the sleep changes the count
+	 * and the futex returns at once.
+	 */
+	fly_atomic_inc(&sem->nbwaiting, 1);
+	while (fly_sem_trywait(sem) != 0)
+		fly_futex_wait(&sem->count, 0);
+	fly_atomic_dec(&sem->nbwaiting, 1);
+}
+
+/* returns 0 if the semaphore was taken within usec microseconds */
+static inline int fly_sem_spin_wait(struct fly_sem *sem, int usec)
+{
+	long long end = fly_thread_time_usec() + usec;
+	int i;
+	for (i = 1; ; i++) {
+		if (fly_sem_trywait(sem) == 0)
+			return 0;
+		fly_cpu_relax();
+		/* the clock is cheap, but not as cheap as pause */
+		if (!(i % 64) && (fly_thread_time_usec() >= end))
+			return -1;
+	}
+}
+
+static inline int fly_sem_notrack_wait(struct fly_sem *sem)
+{
+	int i;
+	for (i = 0; i < fly_sem_spin; i++) {
+		if (fly_sem_trywait(sem) == 0)
+			return 0;
+		fly_cpu_relax();
+	}
+	fly_sem_park(sem);
+	return 0;
 }
 
 static inline int fly_sem_wait(struct fly_sem *sem, struct fly_thread *thread)
 {
 	int err;
 	thread->state = FLY_THREAD_SLEEP;
-	err = sem_wait(&sem->sem);
+	err = fly_sem_notrack_wait(sem);
 	thread->state = FLY_THREAD_RUNNING;
 	return err;
 }
 
-static inline int fly_sem_notrack_wait(struct fly_sem *sem)
-{
-	return sem_wait(&sem->sem);
-}
-
 static inline int fly_sem_post(struct fly_sem *sem)
 {
-	return sem_post(&sem->sem);
+	fly_atomic_inc(&sem->count, 1);
+	if (sem->nbwaiting > 0)
+		fly_futex_wake(&sem->count, 1);
+	return 0;
 }
 
 #endif /* LIBFLY_FLY_SEM_H */
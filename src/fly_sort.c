@@ -0,0 +1,196 @@
+/******************************************************************************
+ * fly_sort.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+#include "fly_globals.h"
+#include "fly_sched.h"
+
+#include <stdlib.h> /* for qsort */
+#include <string.h> /* for memcpy */
+
+/*
+ * Merge sort. Chunks of at least cutoff elements are sorted with qsort, then
+ * the sorted runs are merged pairwise a level at a time, alternating between
+ * the array and a buffer. Every merge is cut in pieces along the merge path
+ * so even the last level, one pair of runs, keeps all workers busy.
+ */
+#define FLY_SORT_DEFAULT_CUTOFF		8192
+#define FLY_SORT_CHUNKS_PER_WORKER	2
+#define FLY_SORT_PIECES_PER_WORKER	4
+
+struct fly_sort {
+	char				*src;
+	char				*dst;
+	int					nb;
+	size_t				elsize;
+	fly_sort_cmp_func	cmp;
+	int					chunk;
+	int					width; /* of the runs merged at this level */
+	int					pairpieces;
+	int					piece;
+}; /* struct fly_sort */
+
+static inline char *sort_el(struct fly_sort *s, char *arr, int ind)
+{
+	return arr + ((size_t)ind * s->elsize);
+}
+
+static void sort_chunk(int ind, void *param)
+{
+	struct fly_sort *s = param;
+	int start = ind * s->chunk;
+	int nb = ((s->nb - start) > s->chunk) ? s->chunk : (s->nb - start);
+	qsort(sort_el(s, s->src, start), nb, s->elsize, s->cmp);
+}
+
+static void sort_copy_chunk(int ind, void *param)
+{
+	struct fly_sort *s = param;
+	int start = ind * s->chunk;
+	int nb = ((s->nb - start) > s->chunk) ? s->chunk : (s->nb - start);
+	memcpy(sort_el(s, s->dst, start), sort_el(s, s->src, start),
+			(size_t)nb * s->elsize);
+}
+
+/*
+ * How many of the first k merged elements come from a. Equal elements are
+ * taken from a first.
+ */
+static int sort_split(struct fly_sort *s, char *a, int na, char *b, int nb,
+		int k)
+{
+	int lo = (k > nb) ? (k - nb) : 0;
+	int hi = (k < na) ? k : na;
+	while (lo < hi) {
+		int i = lo + ((hi - lo) / 2);
+		if (s->cmp(sort_el(s, a, i), sort_el(s, b, k - i - 1)) <= 0)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	return lo;
+}
+
+/* one piece of the merge of a pair of runs */
+static void sort_merge_piece(int ind, void *param)
+{
+	struct fly_sort *s = param;
+	int pair = ind / s->pairpieces;
+	int start = pair * 2 * s->width;
+	int mid = ((s->nb - start) > s->width) ? (start + s->width) : s->nb;
+	int end = ((s->nb - mid) > s->width) ? (mid + s->width) : s->nb;
+	int first = (ind % s->pairpieces) * s->piece;
+	int last = first + s->piece;
+	char *a = sort_el(s, s->src, start);
+	char *b = sort_el(s, s->src, mid);
+	char *out;
+	int i;
+	int j;
+	int ia;
+	int ib;
+
+	if (last > (end - start))
+		last = end - start;
+	if (first >= last)
+		return;
+	i = sort_split(s, a, mid - start, b, end - mid, first);
+	j = first - i;
+	ia = sort_split(s, a, mid - start, b, end - mid, last);
+	ib = last - ia;
+	out = sort_el(s, s->dst, start + first);
+	while ((i < ia) && (j < ib)) {
+		if (s->cmp(sort_el(s, b, j), sort_el(s, a, i)) < 0)
+			memcpy(out, sort_el(s, b, j++), s->elsize);
+		else
+			memcpy(out, sort_el(s, a, i++), s->elsize);
+		out += s->elsize;
+	}
+	if (i < ia)
+		memcpy(out, sort_el(s, a, i), (size_t)(ia - i) * s->elsize);
+	else if (j < ib)
+		memcpy(out, sort_el(s, b, j), (size_t)(ib - j) * s->elsize);
+}
+
+static inline void sort_swap(struct fly_sort *s)
+{
+	char *tmp = s->src;
+	s->src = s->dst;
+	s->dst = tmp;
+}
+
+int fly_parallel_sort_ex(void *base, int nb, size_t elsize,
+		fly_sort_cmp_func cmp, int cutoff)
+{
+	struct fly_sort s;
+	char *buff;
+	int nbchunks;
+	int nbpieces;
+	int err;
+
+	if (cutoff <= 0)
+		cutoff = FLY_SORT_DEFAULT_CUTOFF;
+	if (nb <= cutoff) {
+		qsort(base, nb, elsize, cmp);
+		return FLYESUCCESS;
+	}
+	buff = fly_malloc((size_t)nb * elsize);
+	if (!buff)
+		return FLYENORES;
+	nbchunks = fly_get_nbworkers() * FLY_SORT_CHUNKS_PER_WORKER;
+	nbpieces = fly_get_nbworkers() * FLY_SORT_PIECES_PER_WORKER;
+	s.src = base;
+	s.dst = buff;
+	s.nb = nb;
+	s.elsize = elsize;
+	s.cmp = cmp;
+	s.chunk = (nb + nbchunks - 1) / nbchunks;
+	if (s.chunk < cutoff)
+		s.chunk = cutoff;
+	nbchunks = (nb + s.chunk - 1) / s.chunk;
+
+	err = fly_parallel_for(nbchunks, sort_chunk, &s);
+	for (s.width = s.chunk; FLY_SUCCEEDED(err) && (s.width < nb);
+			s.width *= 2) {
+		int nbpairs = (nb + (2 * s.width) - 1) / (2 * s.width);
+		s.pairpieces = (nbpieces + nbpairs - 1) / nbpairs;
+		s.piece = ((2 * s.width) + s.pairpieces - 1) / s.pairpieces;
+		if (s.piece < cutoff) {
+			s.piece = cutoff;
+			s.pairpieces = ((2 * s.width) + cutoff - 1) / cutoff;
+		}
+		err = fly_parallel_for(nbpairs * s.pairpieces, sort_merge_piece, &s);
+		if (FLY_SUCCEEDED(err))
+			sort_swap(&s);
+	}
+	/* src holds the last complete level, copy it back if it is the buffer */
+	if (s.src == buff) {
+		s.dst = base;
+		if (!FLY_SUCCEEDED(fly_parallel_for(nbchunks, sort_copy_chunk, &s)))
+			memcpy(base, buff, (size_t)nb * elsize);
+	}
+	fly_free(buff);
+	return err;
+}
+
+int fly_parallel_sort(void *base, int nb, size_t elsize, fly_sort_cmp_func cmp)
+{
+	return fly_parallel_sort_ex(base, nb, elsize, cmp, 0);
+}
@@ -27,6 +27,12 @@ struct fly_task {
 	void			*param;
 	void			*result;
 
+	/* completed task goes there, see fly_task_set_queue */
+	struct fly_task_queue	*queue;
+
+	/* the group of the last push, its job is released on completion */
+	struct fly_task_group	*group;
+
 	/* data used by scheduler to identify this task */
 	void			*sched_data;
 }; /* struct fly_task */
@@ -27,12 +27,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h> /* for sprintf */
+#include <string.h> /* for strstr */
 
 #define FLY_PROCESS_MAX_NAME_LEN	256
 #define FLY_THREAD_DEFAULT_READ_LEN	512
 #define FLY_INVALID_FD				-1
 
 #define FLY_PROCFS_STATUS_FMT_STR	"/proc/self/task/%d/status"
+#define FLY_PROCFS_STATE_TAG		"State:"
 
 /******************************************************************************
  * Proc file system parsing.
@@ -68,6 +70,7 @@ int fly_thread_init(struct fly_thread *thread,
 			thread->param = param;
 			thread->state = FLY_THREAD_IDLE;
 			thread->fd = FLY_INVALID_FD;
+			thread->started = 0;
 			return FLYESUCCESS;
 		} else {
 			fly_free(thread->attr);
@@ -91,20 +94,41 @@ int fly_thread_start(struct fly_thread *thread)
 	int ret;
 	ret = pthread_create(&thread->pthread, thread->attr,
 			fly_thread_wrap_func, thread);
+	if (ret == 0)
+		thread->started = 1;
 	return ret;
 }
 
+/* takes effect when the thread is started */
+int fly_thread_set_cpu(struct fly_thread *thread, int cpu)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_attr_setaffinity_np(thread->attr, sizeof(cpu_set_t), &set))
+		return FLYEATTR;
+	return FLYESUCCESS;
+}
+
+/* a thread which was never started has nothing to wait for */
 int fly_thread_wait(struct fly_thread *thread)
 {
+	if (!thread->started)
+		return FLYESUCCESS;
 	pthread_join(thread->pthread, NULL);
+	thread->started = 0;
 	return FLYESUCCESS;
 }
 
+/*
+ * The OS bits are not stored back - the state belongs to the thread itself
+ * and writing it from here races with its own updates.
+ */
 enum fly_thread_state fly_thread_get_state(struct fly_thread *thread)
 {
-	thread->state &= FLY_THREAD_CLEAR_OS_BITS_MASK;
-	thread->state = get_thread_state(thread->fd, thread->state);
-	return thread->state;
+	enum fly_thread_state state = thread->state;
+	state &= FLY_THREAD_CLEAR_OS_BITS_MASK;
+	return get_thread_state(thread->fd, state);
 }
 
 int fly_thread_is_client_block(struct fly_thread *thread)
@@ -131,33 +155,32 @@ static enum fly_thread_state get_thread_state(int fd,
 {
 	enum fly_thread_state ret = expected_state;
 	char buff[FLY_THREAD_DEFAULT_READ_LEN];
-	int readed = read(fd, buff, FLY_THREAD_DEFAULT_READ_LEN);
-	if (readed != -1) {
-		int i;
-		const int stateend = 7;
-		for (i = 5;; i++) {
-			if (buff[i] == '\n') {
-				i += stateend;
-				while ((buff[i] == '\t') || (buff[i] == ' ')) i++;
-				switch (buff[i]) {
-				case 'D':
-					ret |= FLY_THREAD_CLIENT_USLEEP;
-					break;
-				case 'R':
-					ret |= FLY_THREAD_RUNNING;
-					break;
-				case 'S':
-					ret |= FLY_THREAD_CLIENT_ISLEEP;
-					break;
-				case 'T':
-					ret |= FLY_THREAD_TRAPPED;
-					break;
-				case 'X':
-				case 'Z':
-				default:
-					/* Should never come here... */
-					break;
-				}
+	/* the status file is reread from the start on every update */
+	int readed = pread(fd, buff, FLY_THREAD_DEFAULT_READ_LEN - 1, 0);
+	if (readed > 0) {
+		char *state;
+		buff[readed] = '\0';
+		state = strstr(buff, FLY_PROCFS_STATE_TAG);
+		if (state) {
+			state += sizeof(FLY_PROCFS_STATE_TAG) - 1;
+			while ((*state == '\t') || (*state == ' ')) state++;
+			switch (*state) {
+			case 'D':
+				ret |= FLY_THREAD_CLIENT_USLEEP;
+				break;
+			case 'R':
+				ret |= FLY_THREAD_RUNNING;
+				break;
+			case 'S':
+				ret |= FLY_THREAD_CLIENT_ISLEEP;
+				break;
+			case 'T':
+				ret |= FLY_THREAD_TRAPPED;
+				break;
+			case 'X':
+			case 'Z':
+			default:
+				/* Should never come here... */
 				break;
 			}
 		}
@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 
 typedef void *(*fly_thread_func)(void*);
@@ -52,12 +53,14 @@ struct fly_thread {
 	/* thread id given by the OS */
 	pid_t					tid;
 	int						fd;
+	int						started;
 }; /* struct fly_thread */
 
 int fly_thread_init(struct fly_thread *thread,
 		fly_thread_func func, void *param);
 int fly_thread_uninit(struct fly_thread *thread);
 int fly_thread_start(struct fly_thread *thread);
+int fly_thread_set_cpu(struct fly_thread *thread, int cpu);
 
 int fly_thread_wait(struct fly_thread *thread);
 
@@ -73,4 +76,17 @@ static inline void fly_thread_sleep(unsigned int nanosec)
 	nanosleep(&delay, NULL);
 }
 
+/* monotonic time, for measuring intervals */
+static inline long long fly_thread_time_usec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec * 1000000LL) + (now.tv_nsec / 1000);
+}
+
+static inline void fly_thread_yield()
+{
+	sched_yield();
+}
+
 #endif /* FLY_THREAD_H */
@@ -0,0 +1,254 @@
+/******************************************************************************
+ * fly_topology.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include "fly_topology.h"
+#include <libfly/fly_error.h>
+#include "fly_globals.h"
+
+#include <sched.h>
+#include <stdio.h> /* for fopen */
+#include <stdlib.h> /* for strtol */
+#include <unistd.h> /* for syscall, sysconf */
+#include <sys/syscall.h>
+
+#define FLY_SYSFS_SIBLINGS_FMT_STR \
+	"/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list"
+#define FLY_SYSFS_NODES_STR			"/sys/devices/system/node/online"
+#define FLY_SYSFS_NODE_CPUS_FMT_STR	"/sys/devices/system/node/node%d/cpulist"
+#define FLY_TOPOLOGY_READ_LEN	256
+
+/******************************************************************************
+ * sysfs parsing.
+ *****************************************************************************/
+/* cpu and node lists look like "0-3,8,10-11" */
+static void parse_list(const char *str, cpu_set_t *set)
+{
+	char *end;
+	CPU_ZERO(set);
+	while (*str) {
+		int first = strtol(str, &end, 10);
+		int last = first;
+		int cpu;
+		if (end == str)
+			break;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+		}
+		for (cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++)
+			CPU_SET(cpu, set);
+		str = end;
+		if (*str == ',')
+			str++;
+		else
+			break;
+	}
+}
+
+/* returns 0 if the file is missing */
+static int read_list(const char *path, cpu_set_t *set)
+{
+	char buff[FLY_TOPOLOGY_READ_LEN] = {0};
+	FILE *file = fopen(path, "r");
+	int ret = 0;
+	if (!file)
+		return 0;
+	if (fgets(buff, FLY_TOPOLOGY_READ_LEN, file)) {
+		parse_list(buff, set);
+		ret = 1;
+	}
+	fclose(file);
+	return ret;
+}
+
+/* SMT siblings of cpu which come before it in allowed, 0 without sysfs */
+static int get_smt_rank(int cpu, cpu_set_t *allowed)
+{
+	char path[512] = {0};
+	cpu_set_t siblings;
+	int rank = 0;
+	int i;
+
+	sprintf(path, FLY_SYSFS_SIBLINGS_FMT_STR, cpu);
+	if (!read_list(path, &siblings))
+		return 0;
+	for (i = 0; i < cpu; i++) {
+		if (CPU_ISSET(i, &siblings) && CPU_ISSET(i, allowed))
+			rank++;
+	}
+	return rank;
+}
+
+/* one node without sysfs, nodes without usable CPUs are skipped */
+static void read_nodes(struct fly_topology *topo)
+{
+	char path[512] = {0};
+	cpu_set_t nodes;
+	cpu_set_t nodecpus;
+	int nodeid;
+	int i;
+
+	topo->nbnodes = 1;
+	topo->nodeids[0] = 0;
+	for (i = 0; i < topo->nbcpus; i++)
+		topo->cpunodes[i] = 0;
+	if (!read_list(FLY_SYSFS_NODES_STR, &nodes))
+		return;
+	topo->nbnodes = 0;
+	for (nodeid = 0; nodeid < CPU_SETSIZE; nodeid++) {
+		int used = 0;
+		if (!CPU_ISSET(nodeid, &nodes))
+			continue;
+		sprintf(path, FLY_SYSFS_NODE_CPUS_FMT_STR, nodeid);
+		if (!read_list(path, &nodecpus))
+			continue;
+		for (i = 0; i < topo->nbcpus; i++) {
+			if (CPU_ISSET(topo->cpus[i], &nodecpus)) {
+				topo->cpunodes[i] = topo->nbnodes;
+				used = 1;
+			}
+		}
+		if (used)
+			topo->nodeids[topo->nbnodes++] = nodeid;
+		if (topo->nbnodes == FLY_TOPOLOGY_MAX_NODES)
+			break;
+	}
+	if (!topo->nbnodes) {
+		topo->nbnodes = 1;
+		topo->nodeids[0] = 0;
+	}
+}
+
+/******************************************************************************
+ * fly_topology interface implementation.
+ *****************************************************************************/
+int fly_topology_init(struct fly_topology *topo)
+{
+	cpu_set_t allowed;
+	int ranks[CPU_SETSIZE];
+	int rank;
+	int cpu;
+
+	topo->cpus = NULL;
+	topo->cpunodes = NULL;
+	topo->nbcpus = 0;
+	topo->nbnodes = 0;
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0)
+		return FLYELLLIB;
+	topo->cpus = fly_malloc(CPU_COUNT(&allowed) * sizeof(int));
+	if (!topo->cpus)
+		return FLYENORES;
+	topo->cpunodes = fly_malloc(CPU_COUNT(&allowed) * sizeof(int));
+	if (!topo->cpunodes) {
+		fly_free(topo->cpus);
+		topo->cpus = NULL;
+		return FLYENORES;
+	}
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed))
+			ranks[cpu] = get_smt_rank(cpu, &allowed);
+	}
+	/* first threads of the cores, then the second ones and so on */
+	for (rank = 0; topo->nbcpus < CPU_COUNT(&allowed); rank++) {
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed) && (ranks[cpu] == rank))
+				topo->cpus[topo->nbcpus++] = cpu;
+		}
+	}
+	read_nodes(topo);
+	return FLYESUCCESS;
+}
+
+void fly_topology_uninit(struct fly_topology *topo)
+{
+	if (topo->cpus)
+		fly_free(topo->cpus);
+	if (topo->cpunodes)
+		fly_free(topo->cpunodes);
+	topo->cpus = NULL;
+	topo->cpunodes = NULL;
+	topo->nbcpus = 0;
+	topo->nbnodes = 0;
+}
+
+/* the node numbered by the OS as nodeid, -1 if no usable CPU is on it */
+int fly_topology_get_node(struct fly_topology *topo, int nodeid)
+{
+	int i;
+	for (i = 0; i < topo->nbnodes; i++) {
+		if (topo->nodeids[i] == nodeid)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Nodes of the pages holding addrs, -1 if unknown. move_pages without target
+ * nodes only looks the pages up - unlike get_mempolicy it does not fault in a
+ * page nobody touched yet, such a page gives -1 too. Consecutive addrs on one
+ * page share its lookup, all of them go in one call.
+ */
+int fly_topology_addrs_nodes(struct fly_topology *topo, const void **addrs,
+		int *nodes, int count)
+{
+	unsigned long pagemask = ~((unsigned long)sysconf(_SC_PAGESIZE) - 1);
+	void **pages = fly_malloc(count * sizeof(void*));
+	int *status = fly_malloc(count * sizeof(int));
+	int nbpages = 0;
+	int i;
+
+	if (!pages || !status) {
+		if (pages)
+			fly_free(pages);
+		if (status)
+			fly_free(status);
+		return FLYENORES;
+	}
+	for (i = 0; i < count; i++) {
+		void *page = (void*)((unsigned long)addrs[i] & pagemask);
+		if (!nbpages || (pages[nbpages - 1] != page))
+			pages[nbpages++] = page;
+		nodes[i] = nbpages - 1;
+	}
+	if (syscall(SYS_move_pages, 0, nbpages, pages, NULL, status, 0) != 0) {
+		for (i = 0; i < nbpages; i++)
+			status[i] = -1;
+	}
+	for (i = 0; i < count; i++) {
+		int nodeid = status[nodes[i]];
+		nodes[i] = (nodeid < 0) ? -1 : fly_topology_get_node(topo, nodeid);
+	}
+	fly_free(pages);
+	fly_free(status);
+	return FLYESUCCESS;
+}
+
+/* the page of addr is looked up as in fly_topology_addrs_nodes */
+int fly_topology_addr_node(struct fly_topology *topo, const void *addr)
+{
+	unsigned long pagemask = ~((unsigned long)sysconf(_SC_PAGESIZE) - 1);
+	void *page = (void*)((unsigned long)addr & pagemask);
+	int nodeid = -1;
+	if ((syscall(SYS_move_pages, 0, 1, &page, NULL, &nodeid, 0) != 0) ||
+			(nodeid < 0))
+		return -1;
+	return fly_topology_get_node(topo, nodeid);
+}
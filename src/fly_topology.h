@@ -0,0 +1,62 @@
+/******************************************************************************
+ * fly_topology.h
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+/*
+ * CPU topology as seen by the process. Only the CPUs of sched_getaffinity
+ * are listed, in the order the workers should take them - first one thread
+ * of every physical core, then the SMT siblings.
+ * NUMA nodes are numbered from 0 and only the nodes with usable CPUs are
+ * counted, nodeids keeps the numbers the OS uses for them.
+ */
+
+#ifndef LIBFLY_FLY_TOPOLOGY_H
+#define LIBFLY_FLY_TOPOLOGY_H
+
+#define FLY_TOPOLOGY_MAX_NODES	64
+
+struct fly_topology {
+	int		*cpus;
+	int		*cpunodes; /* node of cpus[i] */
+	int		nbcpus;
+	int		nodeids[FLY_TOPOLOGY_MAX_NODES];
+	int		nbnodes;
+}; /* struct fly_topology */
+
+int fly_topology_init(struct fly_topology *topo);
+void fly_topology_uninit(struct fly_topology *topo);
+int fly_topology_get_node(struct fly_topology *topo, int nodeid);
+int fly_topology_addr_node(struct fly_topology *topo, const void *addr);
+int fly_topology_addrs_nodes(struct fly_topology *topo, const void **addrs,
+		int *nodes, int count);
+
+static inline int fly_topology_worker_cpu(struct fly_topology *topo,
+		int worker)
+{
+	return topo->cpus[worker % topo->nbcpus];
+}
+
+static inline int fly_topology_worker_node(struct fly_topology *topo,
+		int worker)
+{
+	return topo->cpunodes[worker % topo->nbcpus];
+}
+
+#endif /* LIBFLY_FLY_TOPOLOGY_H */
@@ -29,12 +29,38 @@
 
 #define FLY_WORKER_STATE_WAIT_NANOSEC 1000
 
+static inline void fly_worker_thread_work_available(struct fly_worker_thread *t);
+
+/* the worker thread of the calling thread, NULL on the other threads */
+static __thread struct fly_worker_thread *fly_worker_self;
+
 /******************************************************************************
  * fly_worker_thread interface
  *****************************************************************************/
-inline void fly_worker_thread_wait_work(struct fly_worker_thread *thread)
+/* spins up to spinusec before it sleeps */
+inline void fly_worker_thread_wait_work(struct fly_worker_thread *thread,
+		int spinusec)
+{
+	thread->thread.state = FLY_THREAD_SLEEP;
+	if ((spinusec <= 0) || (fly_sem_spin_wait(&thread->sem, spinusec) != 0))
+		fly_sem_park(&thread->sem);
+	thread->thread.state = FLY_THREAD_RUNNING;
+}
+
+/*
+ * Idle threads are the only ones posted for new work. The flag is set before
+ * the thread looks for work the last time, so work added after that look
+ * finds the thread idle.
+ */
+void fly_worker_thread_set_idle(struct fly_worker_thread *thread)
+{
+	thread->idle = 1;
+	fly_atomic_barrier();
+}
+
+void fly_worker_thread_set_busy(struct fly_worker_thread *thread)
 {
-	fly_sem_wait(&thread->sem, &thread->thread);
+	thread->idle = 0;
 }
 
 int fly_worker_thread_is_me(struct fly_worker_thread *thread)
@@ -42,13 +68,49 @@ int fly_worker_thread_is_me(struct fly_worker_thread *thread)
 	return fly_thread_is_me(&thread->thread);
 }
 
+struct fly_worker_thread *fly_worker_thread_self()
+{
+	return fly_worker_self;
+}
+
+/*
+ * The other thread of the worker runs while this one is blocked. Attached
+ * threads have no other thread, they only count the depth.
+ */
+void fly_worker_thread_block_begin(struct fly_worker_thread *thread)
+{
+	struct fly_worker *worker = thread->parent;
+	if ((thread->blocking++ > 0) || worker->attached)
+		return;
+	if (thread == &worker->mthread) {
+		fly_atomic_fetch_or(&worker->mblocked, FLY_WORKER_BLOCKED_REGION);
+		fly_worker_thread_work_available(&worker->bthread);
+	} else {
+		fly_atomic_fetch_or(&worker->bblocked, FLY_WORKER_BLOCKED_REGION);
+		fly_worker_thread_work_available(&worker->mthread);
+	}
+}
+
+void fly_worker_thread_block_end(struct fly_worker_thread *thread)
+{
+	struct fly_worker *worker = thread->parent;
+	if ((--thread->blocking > 0) || worker->attached)
+		return;
+	if (thread == &worker->mthread)
+		fly_atomic_fetch_and(&worker->mblocked, ~FLY_WORKER_BLOCKED_REGION);
+	else
+		fly_atomic_fetch_and(&worker->bblocked, ~FLY_WORKER_BLOCKED_REGION);
+}
+
 /******************************************************************************
  * fly_worker_thread private interface
  *****************************************************************************/
 void* fly_worker_thread_func(void *wthread)
 {
 	struct fly_worker_thread *wt = (struct fly_worker_thread*)wthread;
-	while (wt->tstate != FLY_WORKER_RUNNING)
+	fly_worker_self = wt;
+	/* exit may be requested before the thread first sees it running */
+	while (wt->tstate == FLY_WORKER_IDLE)
 		fly_thread_sleep(FLY_WORKER_STATE_WAIT_NANOSEC);
 
 	while (wt->tstate == FLY_WORKER_RUNNING) {
@@ -64,16 +126,38 @@ static inline void fly_worker_thread_work_available(struct fly_worker_thread *t)
 	fly_sem_post(&t->sem);
 }
 
+static inline void fly_worker_thread_steal_from(struct fly_worker_thread *t,
+		struct fly_worker_thread *blocked)
+{
+	if ((t->thread.state & FLY_THREAD_SLEEP) &&
+			!fly_deque_is_empty(&blocked->deque))
+		fly_worker_thread_work_available(t);
+}
+
 static inline int fly_worker_thread_init(struct fly_worker_thread *thread)
 {
 	int err;
+	int i;
 	err = fly_thread_init(&thread->thread, fly_worker_thread_func, thread);
 	if (!FLY_SUCCEEDED(err))
 		return err;
 	err = fly_sem_init(&thread->sem);
 	if (!FLY_SUCCEEDED(err)) {
 		fly_thread_uninit(&thread->thread);
+		return err;
+	}
+	err = fly_deque_init(&thread->deque, FLY_DEQUE_DEFAULT_SIZE);
+	if (!FLY_SUCCEEDED(err)) {
+		fly_sem_uninit(&thread->sem);
+		fly_thread_uninit(&thread->thread);
+		return err;
 	}
+	for (i = 0; i < FLY_POOL_NB_TYPES; i++)
+		fly_pool_init(&thread->pools[i]);
+	/* xorshift seed for picking steal victims - must not be 0 */
+	thread->seed = (unsigned int)((size_t)thread >> 4) | 1;
+	thread->blocking = 0;
+	thread->idle = 0;
 	thread->tstate = FLY_WORKER_IDLE;
 	return err;
 }
@@ -82,6 +166,7 @@ static inline void fly_worker_thread_uninit(struct fly_worker_thread *thread)
 {
 	fly_thread_uninit(&thread->thread);
 	fly_sem_uninit(&thread->sem);
+	fly_deque_uninit(&thread->deque);
 }
 
 static inline int fly_worker_thread_start(struct fly_worker_thread *thread)
@@ -113,6 +198,7 @@ int fly_worker_init(struct fly_worker *worker)
 
 	worker->mblocked = 0;
 	worker->bblocked = 0;
+	worker->node = 0;
 
 	worker->mthread.parent = worker;
 	err = fly_worker_thread_init(&worker->mthread);
@@ -152,6 +238,15 @@ int fly_worker_start(struct fly_worker *worker)
 	return ret;
 }
 
+/* the backup thread runs only while the main one is blocked - same CPU */
+int fly_worker_set_cpu(struct fly_worker *worker, int cpu)
+{
+	int err = fly_thread_set_cpu(&worker->mthread.thread, cpu);
+	if (FLY_SUCCEEDED(err))
+		err = fly_thread_set_cpu(&worker->bthread.thread, cpu);
+	return err;
+}
+
 void fly_worker_request_exit(struct fly_worker *worker)
 {
 	fly_worker_thread_request_exit(&worker->mthread);
@@ -165,27 +260,90 @@ int fly_worker_wait(struct fly_worker *worker)
 	return err;
 }
 
-void fly_worker_work_available(struct fly_worker *worker)
+/* the backup thread takes the work while the main thread is blocked */
+static inline struct fly_worker_thread *fly_worker_work_thread(
+		struct fly_worker *worker)
 {
-	if (fly_atomic_and(&worker->mblocked, 1)
-		&& !fly_atomic_and(&worker->bblocked, 1)) {
-		fly_worker_thread_work_available(&worker->bthread);
-	} else {
-		fly_worker_thread_work_available(&worker->mthread);
+	if (worker->mblocked && !worker->bblocked)
+		return &worker->bthread;
+	return &worker->mthread;
+}
+
+/* returns 1 if the worker was idle and is woken */
+int fly_worker_wake_idle(struct fly_worker *worker)
+{
+	struct fly_worker_thread *thread = fly_worker_work_thread(worker);
+	if (!thread->idle || !fly_atomic_cas(&thread->idle, 1, 0))
+		return 0;
+	fly_worker_thread_work_available(thread);
+	return 1;
+}
+
+/*
+ * Sets or clears the poll bit of flags, returns 1 if the thread was found
+ * blocked and was not known to be before.
+ */
+static inline int fly_worker_poll_blocked(volatile int *flags, int blocked)
+{
+	if (!blocked) {
+		fly_atomic_fetch_and(flags, ~FLY_WORKER_BLOCKED_POLL);
+		return 0;
 	}
+	return !fly_atomic_fetch_or(flags, FLY_WORKER_BLOCKED_POLL);
 }
 
 void fly_worker_update(struct fly_worker *worker)
 {
-	worker->mblocked = fly_thread_is_client_block(&worker->mthread.thread);
-	worker->bblocked = fly_thread_is_client_block(&worker->bthread.thread);
+	int mwake = fly_worker_poll_blocked(&worker->mblocked,
+			fly_thread_is_client_block(&worker->mthread.thread));
+	int bwake = fly_worker_poll_blocked(&worker->bblocked,
+			fly_thread_is_client_block(&worker->bthread.thread));
+	/*
+	 * A thread just found blocked may hold back work queued for the worker.
+	 * The flags are published first, so a push racing with the wake-up
+	 * either posts the other thread itself or is seen by it.
+	 */
+	fly_atomic_barrier();
+	if (mwake)
+		fly_worker_thread_work_available(&worker->bthread);
+	if (bwake)
+		fly_worker_thread_work_available(&worker->mthread);
+	/*
+	 * Jobs left in the deque of a blocked thread can only be stolen,
+	 * so wake the other thread of the worker if it sleeps.
+	 */
+	if (worker->mblocked)
+		fly_worker_thread_steal_from(&worker->bthread, &worker->mthread);
+	if (worker->bblocked)
+		fly_worker_thread_steal_from(&worker->mthread, &worker->bthread);
 }
 
-struct fly_worker_thread *fly_worker_get_curr_thread(struct fly_worker *worker)
+/*
+ * The calling thread becomes the main thread of worker, which is not one of
+ * the workers of fly_sched and never starts threads of its own. Only mthread
+ * is set up, there is no backup thread.
+ */
+int fly_worker_attach(struct fly_worker *worker, int node)
 {
-	if (fly_worker_thread_is_me(&worker->mthread))
-		return &worker->mthread;
-	if (fly_worker_thread_is_me(&worker->bthread))
-		return &worker->bthread;
-	return NULL;
+	int err;
+	memset(worker, 0, sizeof(struct fly_worker));
+	worker->node = node;
+	worker->attached = 1;
+	worker->mthread.parent = worker;
+	worker->bthread.parent = worker;
+	err = fly_worker_thread_init(&worker->mthread);
+	if (!FLY_SUCCEEDED(err))
+		return err;
+	worker->mthread.thread.state = FLY_THREAD_RUNNING;
+	worker->mthread.tstate = FLY_WORKER_RUNNING;
+	fly_worker_self = &worker->mthread;
+	return err;
+}
+
+/* called by the attached thread itself, once no other thread uses worker */
+void fly_worker_detach(struct fly_worker *worker)
+{
+	fly_worker_self = NULL;
+	worker->mthread.tstate = FLY_WORKER_FINISHED;
+	fly_worker_thread_uninit(&worker->mthread);
 }
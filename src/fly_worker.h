@@ -23,6 +23,8 @@
 #define FLY_WORKER_H
 
 #include "fly_list.h"
+#include "fly_deque.h"
+#include "fly_pool.h"
 #include "fly_thread.h"
 #include "fly_sem.h"
 
@@ -37,16 +39,31 @@ typedef int fly_worker_state;
 struct fly_worker_thread {
 	struct fly_thread	thread;
 	struct fly_sem		sem;
+	struct fly_deque	deque;
+	struct fly_pool		pools[FLY_POOL_NB_TYPES];
 	struct fly_worker	*parent;
 	fly_worker_state	tstate;
 	int					active;
+	int					blocking; /* depth of fly_blocking_begin */
+	volatile int		idle; /* about to sleep or sleeping, see fly_schedule */
+	int					idleavg; /* recent waits for work in us */
+	unsigned int		seed;
 }; /* struct fly_worker_thread */
 
+/*
+ * Sources of the blocked flags of a worker. The thread sets its region bit
+ * and the poll thread the other, each one only its own with atomic updates.
+ */
+#define FLY_WORKER_BLOCKED_REGION	1
+#define FLY_WORKER_BLOCKED_POLL		2
+
 struct fly_worker {
 	struct fly_worker_thread	mthread;
 	struct fly_worker_thread	bthread;
-	int							mblocked;
-	int							bblocked;
+	volatile int				mblocked;
+	volatile int				bblocked;
+	int							node; /* NUMA node group, see fly_sched */
+	int							attached; /* see fly_worker_attach */
 }; /* fly_worker */
 
 /******************************************************************************
@@ -55,16 +72,24 @@ struct fly_worker {
 int fly_worker_init(struct fly_worker *worker);
 int fly_worker_uninit(struct fly_worker *worker);
 int fly_worker_start(struct fly_worker *worker);
+int fly_worker_set_cpu(struct fly_worker *worker, int cpu);
 void fly_worker_request_exit(struct fly_worker *worker);
 int fly_worker_wait(struct fly_worker *worker);
-void fly_worker_work_available(struct fly_worker *worker);
+int fly_worker_wake_idle(struct fly_worker *worker);
 void fly_worker_update(struct fly_worker *worker);
-struct fly_worker_thread *fly_worker_get_curr_thread(struct fly_worker *worker);
+int fly_worker_attach(struct fly_worker *worker, int node);
+void fly_worker_detach(struct fly_worker *worker);
 
 /******************************************************************************
  * fly_worker_thread interface
  *****************************************************************************/
-void fly_worker_thread_wait_work(struct fly_worker_thread *thread);
+void fly_worker_thread_wait_work(struct fly_worker_thread *thread,
+		int spinusec);
+void fly_worker_thread_set_idle(struct fly_worker_thread *thread);
+void fly_worker_thread_set_busy(struct fly_worker_thread *thread);
 int fly_worker_thread_is_me(struct fly_worker_thread *thread);
+struct fly_worker_thread *fly_worker_thread_self();
+void fly_worker_thread_block_begin(struct fly_worker_thread *thread);
+void fly_worker_thread_block_end(struct fly_worker_thread *thread);
 
 #endif /* FLY_WORKER_H */
@@ -35,18 +35,186 @@ typedef void (*fly_free_func)(void*);
 void fly_set_malloc(fly_malloc_func func);
 void fly_set_free(fly_free_func func);
 
+/*
+ * Released jobs and tasks are kept in pools and reused. Hits are the objects
+ * taken from the pools, misses the ones which had to be allocated.
+ */
+struct fly_pool_stats {
+	unsigned long	job_hits;
+	unsigned long	job_misses;
+	unsigned long	task_hits;
+	unsigned long	task_misses;
+}; /* struct fly_pool_stats */
+void fly_get_pool_stats(struct fly_pool_stats *stats);
+
 /******************************************************************************
  * libfly initialization
  *****************************************************************************/
+/*
+ * What a worker does when it runs out of work.
+ * FLY_IDLE_PARK - sleep at once.
+ * FLY_IDLE_SPIN - wait up to idle_spin_us for new work spinning, then sleep.
+ * FLY_IDLE_ADAPTIVE - spin like FLY_IDLE_SPIN while the recent waits for work
+ *	were shorter than idle_spin_us and sleep at once otherwise. Never spins
+ *	on single CPU machines.
+ */
+enum fly_idle_policy {
+	FLY_IDLE_PARK,
+	FLY_IDLE_SPIN,
+	FLY_IDLE_ADAPTIVE
+}; /* enum fly_idle_policy */
+
+/*
+ * poll_blocked - fallback for code which blocks without fly_blocking_begin.
+ * A scheduler thread checks /proc every millisecond while there is work and
+ * lets the backup thread run when it finds the main thread of a worker
+ * blocked. Off by default.
+ * idle_policy, idle_spin_us - FLY_IDLE_ADAPTIVE with 50us by default.
+ * pin_workers - pin every worker to its own CPU, taking one thread of every
+ * physical core before the SMT siblings. Only the CPUs of the process
+ * affinity mask are used. Off by default.
+ * numa_nodes - workers are grouped by the NUMA node of their CPU when they are
+ * pinned, see FLY_PFOR_NODE. A value > 0 splits the workers in that many
+ * groups instead, in order, whatever the machine looks like. 0 by default.
+ * prio_aging_us - a task which waited that long is taken before the tasks of
+ * higher priority, see fly_push_task_prio. 0 by default - priorities are
+ * strict.
+ */
+struct fly_config {
+	int						nbworkers;
+	int						poll_blocked;
+	enum fly_idle_policy	idle_policy;
+	int						idle_spin_us;
+	int						pin_workers;
+	int						numa_nodes;
+	int						prio_aging_us;
+}; /* struct fly_config */
+
+void fly_config_init(struct fly_config *config, int nbworkers);
+int fly_init(const struct fly_config *config);
 int fly_simple_init(int nbworkers);
 int fly_uninit();
 
+/*
+ * Mark a call which may block the calling thread(IO, waiting on locks, etc).
+ * Called from a worker thread it lets the backup thread of the worker run
+ * until fly_blocking_end. Does nothing on other threads. May nest.
+ */
+void fly_blocking_begin();
+void fly_blocking_end();
+
+/*
+ * An application thread takes part in the scheduling like an extra worker
+ * between fly_attach_thread and fly_detach_thread: the tasks it pushes go to
+ * its own deque, which the workers steal from, and it runs other jobs while
+ * it waits. fly_run_until runs jobs on an attached thread until cond(arg)
+ * returns non 0, checking cond again between the jobs and every 50us while
+ * there are none, and works on the workers too. fly_detach_thread runs the
+ * jobs still on the deque first. FLYEATTR when a worker or an attached thread
+ * attaches, or a thread which is not attached detaches or runs. Detach all
+ * threads before fly_uninit.
+ */
+typedef int (*fly_run_until_func)(void*);
+int fly_attach_thread();
+int fly_detach_thread();
+int fly_run_until(fly_run_until_func cond, void *arg);
+
 
 typedef void (*fly_parallel_for_func)(int, void*);
 int fly_parallel_for(int count, fly_parallel_for_func func, void *ptr);
 int fly_parallel_for_arr(int start, int end, fly_parallel_for_func func,
 		void *arr, size_t elsize);
 
+/*
+ * parallel_for with selectable schedule.
+ * FLY_PFOR_STATIC - equal batches, or batches of grain iterations if grain > 0.
+ * FLY_PFOR_DYNAMIC - every thread takes the next grain iterations.
+ * FLY_PFOR_GUIDED - chunks shrink with the remaining iterations, but never
+ * below grain.
+ * FLY_PFOR_ADAPTIVE - every thread runs its own range a chunk at a time and
+ * idle threads split off the upper half of the biggest remaining range. grain
+ * is the chunk size, by default it is a part of the remaining range.
+ * FLY_PFOR_NODE - batches like FLY_PFOR_STATIC, each run by the workers of
+ * the NUMA node holding the memory of the batch before the other workers help.
+ * Only the array variants know where the memory is, the others give every
+ * node the batches FLY_PFOR_STATIC would. The same as FLY_PFOR_STATIC when
+ * there is one node.
+ */
+enum fly_pfor_schedule {
+	FLY_PFOR_STATIC = 0,
+	FLY_PFOR_DYNAMIC,
+	FLY_PFOR_GUIDED,
+	FLY_PFOR_ADAPTIVE,
+	FLY_PFOR_NODE
+}; /* enum fly_pfor_schedule */
+
+int fly_parallel_for_ex(int count, fly_parallel_for_func func, void *ptr,
+		enum fly_pfor_schedule schedule, int grain);
+int fly_parallel_for_arr_ex(int start, int end, fly_parallel_for_func func,
+		void *arr, size_t elsize, enum fly_pfor_schedule schedule, int grain);
+
+/*
+ * Range variants - func is called once per batch with [range_start, range_end)
+ * so the loop over the batch is in the user code.
+ */
+typedef void (*fly_parallel_range_func)(int, int, void*);
+int fly_parallel_for_range(int start, int end, fly_parallel_range_func func,
+		void *ptr);
+int fly_parallel_for_range_arr(int start, int end, fly_parallel_range_func func,
+		void *arr, size_t elsize);
+
+/*
+ * Reduction of [start, end) in chunks. The partial result of every chunk
+ * starts as a copy of identity(elsize bytes) and map(range_start, range_end,
+ * partial, ptr) adds the chunk to it. combine(dst, src, ptr) adds src to dst
+ * and must be associative, the chunks are combined in index order. The final
+ * value is written to result.
+ * FLY_REDUCE_FAST - chunks follow the number of workers.
+ * FLY_REDUCE_DETERMINISTIC - chunks of grain(1024 by default) iterations
+ *	combined in a fixed tree, so floating point results are the same on
+ *	every run and with any number of workers.
+ */
+typedef void (*fly_parallel_map_func)(int, int, void*, void*);
+typedef void (*fly_parallel_combine_func)(void*, const void*, void*);
+enum fly_reduce_mode {
+	FLY_REDUCE_FAST = 0,
+	FLY_REDUCE_DETERMINISTIC
+}; /* enum fly_reduce_mode */
+
+int fly_parallel_reduce(int start, int end, const void *identity,
+		size_t elsize, fly_parallel_map_func map,
+		fly_parallel_combine_func combine, void *ptr, void *result);
+int fly_parallel_reduce_ex(int start, int end, const void *identity,
+		size_t elsize, fly_parallel_map_func map,
+		fly_parallel_combine_func combine, void *ptr, void *result,
+		enum fly_reduce_mode mode, int grain);
+
+/*
+ * Prefix scan of the elsize byte elements in[start, end) to out[start, end),
+ * out may be in. op(acc, el, ptr) adds el to acc and must be associative.
+ * FLY_SCAN_INCLUSIVE - out[i] is in[start] op ... op in[i].
+ * FLY_SCAN_EXCLUSIVE - out[i] is identity op in[start] op ... op in[i - 1].
+ */
+enum fly_scan_type {
+	FLY_SCAN_INCLUSIVE = 0,
+	FLY_SCAN_EXCLUSIVE
+}; /* enum fly_scan_type */
+
+int fly_parallel_scan(int start, int end, const void *in, void *out,
+		size_t elsize, const void *identity, fly_parallel_combine_func op,
+		void *ptr, enum fly_scan_type type);
+
+/*
+ * Sort nb elements of elsize bytes with cmp, which works like the one of
+ * qsort. The order of equal elements is not kept. Parts of up to cutoff
+ * elements are sorted with qsort on one thread, 8192 by default. Needs a
+ * buffer as big as the array.
+ */
+typedef int (*fly_sort_cmp_func)(const void*, const void*);
+int fly_parallel_sort(void *base, int nb, size_t elsize, fly_sort_cmp_func cmp);
+int fly_parallel_sort_ex(void *base, int nb, size_t elsize,
+		fly_sort_cmp_func cmp, int cutoff);
+
 /******************************************************************************
  * Task parallelism
  *****************************************************************************/
@@ -56,8 +224,89 @@ struct fly_task;
 struct fly_task *fly_create_task(fly_task_func func, void *param);
 void fly_destroy_task(struct fly_task *task);
 int fly_push_task(struct fly_task *task);
+
+/*
+ * Bulk variants. fly_create_tasks gives task i the param params + i * elsize,
+ * elsize 0 gives all of them params, and creates none if one fails.
+ * fly_push_tasks pushes all tasks with one pass over the scheduler queues and
+ * one round of wake-ups, or none of them if it fails. The tasks are waited
+ * for as if pushed one by one.
+ */
+int fly_create_tasks(struct fly_task **tasks, fly_task_func func,
+		void *params, size_t elsize, int nbtasks);
+void fly_destroy_tasks(struct fly_task **tasks, int nbtasks);
+int fly_push_tasks(struct fly_task **tasks, int nbtasks);
+
+/*
+ * Workers take FLY_PRIO_HIGH tasks before the tasks on their own deques and
+ * FLY_PRIO_LOW tasks only when there is nothing else. fly_push_task is
+ * FLY_PRIO_NORMAL. Tasks of the other levels go to the shared ready queues
+ * also when pushed from a worker.
+ */
+enum fly_task_prio {
+	FLY_PRIO_HIGH = 0,
+	FLY_PRIO_NORMAL,
+	FLY_PRIO_LOW,
+	FLY_PRIO_NB_LEVELS
+}; /* enum fly_task_prio */
+
+int fly_push_task_prio(struct fly_task *task, enum fly_task_prio prio);
+
+/*
+ * Push task to run once all of deps completed, without blocking any thread
+ * on the way. The deps must be pushed already and must not be waited for
+ * until this returns. Waited for deps count as completed. The task runs with
+ * FLY_PRIO_NORMAL.
+ * fly_task_then(pred, succ) is fly_push_task_after(succ, &pred, 1).
+ */
+int fly_push_task_after(struct fly_task *task, struct fly_task **deps,
+		int nbdeps);
+int fly_task_then(struct fly_task *pred, struct fly_task *succ);
 int fly_wait_task(struct fly_task *task);
 int fly_wait_tasks(struct fly_task **tasks, int nbtasks);
 void *fly_get_task_result(struct fly_task *task);
 
+/*
+ * fly_task_is_done does not block, fly_wait_task returns at once after it
+ * gave 1. fly_wait_any waits for whichever of the pushed tasks completes
+ * first, waits for it like fly_wait_task and gives its index. FLYEATTR if
+ * none of the tasks is pushed and not waited for yet.
+ */
+int fly_task_is_done(struct fly_task *task);
+int fly_wait_any(struct fly_task **tasks, int nbtasks, int *index);
+
+/*
+ * Completion queue. Tasks pushed after fly_task_set_queue go to the queue
+ * when they complete and are taken out in completion order, already waited
+ * for. Only one thread may take tasks from a queue. fly_task_queue_poll
+ * returns NULL if no task is completed, fly_task_queue_wait blocks until one
+ * is and returns NULL only if no pushed task is left.
+ */
+struct fly_task_queue;
+struct fly_task_queue *fly_create_task_queue();
+void fly_destroy_task_queue(struct fly_task_queue *queue);
+void fly_task_set_queue(struct fly_task *task, struct fly_task_queue *queue);
+struct fly_task *fly_task_queue_poll(struct fly_task_queue *queue);
+struct fly_task *fly_task_queue_wait(struct fly_task_queue *queue);
+
+/*
+ * Task group. The tasks pushed to a group share one counter instead of being
+ * waited for one by one - after fly_group_wait all of them completed and can
+ * be destroyed or pushed again. They must not be waited for otherwise. A task
+ * with a queue is not pushed to a group and a task last pushed to a group is
+ * not a dependency, both give FLYEATTR. fly_group_timed_wait gives
+ * FLYETIMEDOUT if the tasks did not complete within usec microseconds, a
+ * negative usec waits forever. fly_group_cancel skips the tasks which did
+ * not start yet, their result is NULL, the running ones may check
+ * fly_group_is_cancelled. A cancelled group stays cancelled.
+ */
+struct fly_task_group;
+struct fly_task_group *fly_create_task_group();
+void fly_destroy_task_group(struct fly_task_group *group);
+int fly_group_push_task(struct fly_task_group *group, struct fly_task *task);
+int fly_group_wait(struct fly_task_group *group);
+int fly_group_timed_wait(struct fly_task_group *group, long usec);
+void fly_group_cancel(struct fly_task_group *group);
+int fly_group_is_cancelled(struct fly_task_group *group);
+
 #endif /* LIBFLY_FLY_H */
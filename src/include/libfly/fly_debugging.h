@@ -52,7 +52,7 @@ static inline void fly_do_log(const char *subsys, const char *msg)
 #ifdef FLY_ENABLE_ASSERT
 
 #define fly_assert(cond, msg)\
-	if (!cond)\
+	if (!(cond))\
 		printf(msg);\
 	assert(cond)
 
@@ -30,7 +30,9 @@ enum fly_errors {
 
 	FLYELLLIB, /* Low level library failed */
 
-	FLYENOIMP
+	FLYENOIMP,
+
+	FLYETIMEDOUT /* The wait ended before the event */
 }; /* enum fly_errors */
 
 #define FLY_SUCCEEDED(_errcode) (_errcode == FLYESUCCESS)
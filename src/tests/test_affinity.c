@@ -0,0 +1,87 @@
+/******************************************************************************
+ * test_affinity.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <pthread.h> /* for pthread_getaffinity_np */
+#include <sched.h> /* for sched_getaffinity */
+#include <stdio.h> /* for sprintf */
+#include <unistd.h> /* for sysconf */
+
+/*
+ * With pin_workers every worker thread runs on exactly one CPU, which is in
+ * the affinity mask of the process.
+ */
+#define NBITERATIONS	1024
+
+static cpu_set_t process_cpus;
+static volatile int bad_threads;
+
+static void check_cpu(int index, void *ptr)
+{
+	cpu_set_t cpus;
+	int cpu;
+	if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus)) {
+		__sync_add_and_fetch(&bad_threads, 1);
+		return;
+	}
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &cpus))
+			break;
+	}
+	if ((CPU_COUNT(&cpus) != 1) || !CPU_ISSET(cpu, &process_cpus))
+		__sync_add_and_fetch(&bad_threads, 1);
+}
+
+int main(int argc, char **argv)
+{
+	int					errcode;
+	long				nbcpus;
+	struct fly_config	config;
+	char				msg[256];
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+	sched_getaffinity(0, sizeof(cpu_set_t), &process_cpus);
+
+	/* more workers than CPUs - the placement wraps around */
+	fly_config_init(&config, nbcpus + 1);
+	config.pin_workers = 1;
+	errcode = fly_init(&config);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_init failed");
+
+	errcode = fly_parallel_for_ex(NBITERATIONS, check_cpu, NULL,
+			FLY_PFOR_DYNAMIC, 1);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for_ex failed");
+	sprintf(msg, "threads not pinned to one allowed CPU: %d", bad_threads);
+	fly_log("[test_affinity]", msg);
+	fly_assert(bad_threads == 0, "worker threads are not pinned");
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_affinity]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,272 @@
+/******************************************************************************
+ * test_attach_thread.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <pthread.h> /* for pthread_create */
+#include <sched.h> /* for sched_yield */
+#include <stdio.h> /* for sprintf */
+#include <time.h> /* for clock_gettime */
+#include <unistd.h> /* for sysconf, usleep */
+
+/*
+ * Application threads attach, push tasks which only the workers can steal
+ * while the thread does not run any, run a parallel for, run tasks with
+ * fly_run_until and detach with tasks still on their deques. Workers and
+ * threads which are not attached get FLYEATTR.
+ */
+#define NB_APP_THREADS	4
+#define NB_TASKS		256
+#define NB_ITERATIONS	1024
+
+/*
+ * An attached thread runs fly_run_until while a loop of one iteration holds,
+ * so the loop stays running with nothing left to claim, and the condition is
+ * set by a sleeping task. The thread has to sleep between the polls.
+ */
+#define NB_WORKERS		4
+#define SLEEP_USEC		300000
+
+struct app {
+	pthread_t			pthread;
+	struct fly_task		*tasks[NB_TASKS];
+	volatile int		ran;
+	volatile int		iterations;
+}; /* struct app */
+
+static struct app apps[NB_APP_THREADS];
+static volatile int held;
+static volatile int released;
+static volatile int started;
+static volatile int slept;
+
+static void *task_func(void *param)
+{
+	struct app *app = (struct app*)param;
+	__sync_add_and_fetch(&app->ran, 1);
+	return param;
+}
+
+static void iteration(int index, void *ptr)
+{
+	struct app *app = (struct app*)ptr;
+	__sync_add_and_fetch(&app->iterations, 1);
+}
+
+static int all_ran(void *ptr)
+{
+	struct app *app = (struct app*)ptr;
+	return app->ran == NB_TASKS;
+}
+
+static void push_tasks(struct app *app)
+{
+	int errcode;
+	app->ran = 0;
+	errcode = fly_push_tasks(app->tasks, NB_TASKS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_tasks failed");
+	(void)errcode;
+}
+
+static void wait_tasks(struct app *app)
+{
+	int errcode = fly_wait_tasks(app->tasks, NB_TASKS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	fly_assert(app->ran == NB_TASKS, "task did not run once");
+	(void)errcode;
+}
+
+static void *app_thread(void *param)
+{
+	struct app *app = (struct app*)param;
+	int errcode;
+
+	errcode = fly_attach_thread();
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_attach_thread failed");
+	errcode = fly_attach_thread();
+	fly_assert(errcode == FLYEATTR, "thread attached twice");
+
+	/* the thread runs nothing - the workers have to steal the tasks */
+	push_tasks(app);
+	while (app->ran < NB_TASKS)
+		sched_yield();
+	wait_tasks(app);
+
+	app->iterations = 0;
+	errcode = fly_parallel_for(NB_ITERATIONS, iteration, app);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+	fly_assert(app->iterations == NB_ITERATIONS, "iteration lost");
+
+	push_tasks(app);
+	errcode = fly_run_until(all_ran, app);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_run_until failed");
+	wait_tasks(app);
+
+	/* the tasks left on the deque run before the thread leaves */
+	push_tasks(app);
+	errcode = fly_detach_thread();
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_detach_thread failed");
+	wait_tasks(app);
+
+	errcode = fly_detach_thread();
+	fly_assert(errcode == FLYEATTR, "thread detached twice");
+	errcode = fly_run_until(all_ran, app);
+	fly_assert(errcode == FLYEATTR, "fly_run_until on a detached thread");
+	(void)errcode;
+	return param;
+}
+
+static void *attach_worker(void *param)
+{
+	*(int*)param = fly_attach_thread();
+	return param;
+}
+
+static double get_thread_cpu_time_in_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (ts.tv_sec * 1000000.0) + (ts.tv_nsec / 1000.0);
+}
+
+static void hold_iteration(int index, void *ptr)
+{
+	held = 1;
+	while (!released)
+		usleep(1000);
+}
+
+static void *hold_func(void *param)
+{
+	int errcode = fly_parallel_for(1, hold_iteration, NULL);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+	(void)errcode;
+	return param;
+}
+
+static void *sleep_func(void *param)
+{
+	started = 1;
+	usleep(SLEEP_USEC);
+	slept = 1;
+	return param;
+}
+
+static int has_slept(void *ptr)
+{
+	return slept;
+}
+
+static void test_run_until_sleeps()
+{
+	struct fly_task *sleeper = fly_create_task(sleep_func, NULL);
+	pthread_t holder;
+	double cputime;
+	char buf[128];
+	int errcode;
+
+	errcode = fly_simple_init(NB_WORKERS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+	held = 0;
+	released = 0;
+	started = 0;
+	slept = 0;
+	pthread_create(&holder, NULL, hold_func, NULL);
+	while (!held)
+		usleep(1000);
+	/* pushed before attaching - the thread must not run it itself */
+	errcode = fly_push_task(sleeper);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	while (!started)
+		usleep(1000);
+	errcode = fly_attach_thread();
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_attach_thread failed");
+	cputime = get_thread_cpu_time_in_usec();
+	errcode = fly_run_until(has_slept, NULL);
+	cputime = get_thread_cpu_time_in_usec() - cputime;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_run_until failed");
+	errcode = fly_detach_thread();
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_detach_thread failed");
+	errcode = fly_wait_task(sleeper);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	released = 1;
+	pthread_join(holder, NULL);
+	sprintf(buf, "fly_run_until CPU time:\t%f us", cputime);
+	fly_log("[test_attach_thread]", buf);
+	fly_assert(cputime < SLEEP_USEC / 4, "fly_run_until polls without sleep");
+	fly_destroy_task(sleeper);
+
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+}
+
+int main(int argc, char **argv)
+{
+	struct fly_task *task;
+	int errcode;
+	int attached;
+	long nbcpus;
+	int i;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	errcode = fly_detach_thread();
+	fly_assert(errcode == FLYEATTR, "detached a thread which is not attached");
+	errcode = fly_run_until(all_ran, &apps[0]);
+	fly_assert(errcode == FLYEATTR, "fly_run_until on a thread not attached");
+
+	task = fly_create_task(attach_worker, &attached);
+	errcode = fly_push_task(task);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(task);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	fly_assert(attached == FLYEATTR, "a worker attached");
+	fly_destroy_task(task);
+
+	for (i = 0; i < NB_APP_THREADS; i++) {
+		errcode = fly_create_tasks(apps[i].tasks, task_func, &apps[i], 0,
+				NB_TASKS);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_create_tasks failed");
+		errcode = pthread_create(&apps[i].pthread, NULL, app_thread, &apps[i]);
+		fly_assert(errcode == 0, "pthread_create failed");
+	}
+	for (i = 0; i < NB_APP_THREADS; i++) {
+		pthread_join(apps[i].pthread, NULL);
+		fly_destroy_tasks(apps[i].tasks, NB_TASKS);
+	}
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	test_run_until_sleeps();
+
+	fly_log("[test_attach_thread]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/******************************************************************************
+ * test_blocking.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <semaphore.h>
+
+/*
+ * With a single worker the waiter blocks its main thread, so the poster can
+ * only run on the backup thread. That happens only if libfly knows the waiter
+ * blocks - from fly_blocking_begin or from the /proc polling fallback.
+ */
+#define NBROUNDS	16
+
+static sem_t sem;
+
+static void *annotated_waiter(void *param)
+{
+	fly_blocking_begin();
+	sem_wait(&sem);
+	fly_blocking_end();
+	return param;
+}
+
+static void *plain_waiter(void *param)
+{
+	sem_wait(&sem);
+	return param;
+}
+
+static void *poster(void *param)
+{
+	sem_post(&sem);
+	return param;
+}
+
+static void wait_for_poster(fly_task_func waiter)
+{
+	int errcode;
+	int i;
+	for (i = 0; i < NBROUNDS; i++) {
+		struct fly_task *tasks[2];
+		tasks[0] = fly_create_task(waiter, NULL);
+		tasks[1] = fly_create_task(poster, NULL);
+		fly_assert(tasks[0] && tasks[1], "fly_create_task failed");
+		errcode = fly_push_task(tasks[0]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+		errcode = fly_push_task(tasks[1]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+		errcode = fly_wait_tasks(tasks, 2);
+		(void)errcode;
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+		fly_destroy_task(tasks[0]);
+		fly_destroy_task(tasks[1]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int errcode;
+	struct fly_config config;
+
+	sem_init(&sem, 0, 0);
+
+	errcode = fly_simple_init(1);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+	wait_for_poster(annotated_waiter);
+	errcode = fly_uninit();
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+	fly_log("[test_blocking]", "fly_blocking_begin pass");
+
+	fly_config_init(&config, 1);
+	config.poll_blocked = 1;
+	errcode = fly_init(&config);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_init failed");
+	wait_for_poster(plain_waiter);
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+	fly_log("[test_blocking]", "poll_blocked pass");
+
+	sem_destroy(&sem);
+
+	fly_log("[test_blocking]", "All tests pass!");
+
+	return 0;
+}
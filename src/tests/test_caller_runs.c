@@ -0,0 +1,149 @@
+/******************************************************************************
+ * test_caller_runs.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <pthread.h> /* for pthread_self */
+#include <sched.h> /* for sched_yield */
+#include <stdio.h> /* for sprintf */
+#include <unistd.h> /* for sysconf */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+/*
+ * A thread which is not a worker runs iterations of its own loops, with every
+ * schedule, and every iteration still runs once. The workers hold their
+ * iterations until the caller ran one (or WAIT_CALLER_USEC passed), so a
+ * woken worker cannot finish the whole loop before the caller gets the CPU,
+ * and the grains leave more batches than threads. Short loops are timed, they
+ * gain the most from the caller not going to sleep.
+ */
+#define NB_ITERATIONS	1024
+#define SPIN_LOOP_SIZE	1000
+#define NB_SHORT_LOOPS	1000
+#define WAIT_CALLER_USEC	2000000.0
+
+static pthread_t caller;
+static volatile int by_caller;
+static volatile int timedout;
+static volatile int hits[NB_ITERATIONS];
+
+static void iteration(int index, void *ptr)
+{
+	volatile int i;
+	double time;
+	if (pthread_equal(pthread_self(), caller)) {
+		by_caller++;
+	} else {
+		time = get_time_in_usec();
+		while (!by_caller && !timedout) {
+			if (get_time_diff_in_usec(time) > WAIT_CALLER_USEC)
+				timedout = 1;
+			sched_yield();
+		}
+	}
+	for (i = 0; i < SPIN_LOOP_SIZE; i++)
+		;
+	hits[index]++;
+}
+
+static void short_iteration(int index, void *ptr)
+{
+	__sync_add_and_fetch((int*)ptr, 1);
+}
+
+static void test_schedule(enum fly_pfor_schedule schedule, int grain)
+{
+	int errcode;
+	int i;
+	by_caller = 0;
+	timedout = 0;
+	errcode = fly_parallel_for_ex(NB_ITERATIONS, iteration, NULL, schedule,
+			grain);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for_ex failed");
+	(void)errcode;
+	for (i = 0; i < NB_ITERATIONS; i++) {
+		fly_assert(hits[i] == 1, "iteration did not run once");
+		hits[i] = 0;
+	}
+	fly_assert(by_caller > 0, "the caller did not run any iteration");
+}
+
+int main(int argc, char **argv)
+{
+	double time;
+	char buf[128];
+	int errcode;
+	long nbcpus;
+	int count = 0;
+	int i;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	caller = pthread_self();
+	test_schedule(FLY_PFOR_STATIC, 16);
+	test_schedule(FLY_PFOR_DYNAMIC, 1);
+	test_schedule(FLY_PFOR_GUIDED, 1);
+	test_schedule(FLY_PFOR_ADAPTIVE, 0);
+	test_schedule(FLY_PFOR_NODE, 16);
+
+	time = get_time_in_usec();
+	for (i = 0; i < NB_SHORT_LOOPS; i++) {
+		errcode = fly_parallel_for(16, short_iteration, &count);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+	}
+	time = get_time_diff_in_usec(time);
+	fly_assert(count == NB_SHORT_LOOPS * 16, "short loop iteration lost");
+	sprintf(buf, "short loop took:\t%f us", time / NB_SHORT_LOOPS);
+	fly_log("[test_caller_runs]", buf);
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_caller_runs]", "All tests pass!");
+
+	return 0;
+}
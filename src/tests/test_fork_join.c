@@ -0,0 +1,220 @@
+/******************************************************************************
+ * test_fork_join.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <dlfcn.h> /* for dlsym */
+#include <stdio.h> /* for sprintf */
+#include <time.h> /* for clock_gettime */
+#include <unistd.h> /* for sysconf, usleep */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+/*
+ * Fork-join latency - the work is empty, so the times are the cost of
+ * waking the workers, handing out the work and waiting for it.
+ */
+#define NBROUNDS	20000
+
+static volatile int hits;
+
+static void pfor_func(int index, void *ptr)
+{
+	__sync_add_and_fetch(&hits, 1);
+}
+
+static void *task_func(void *param)
+{
+	__sync_add_and_fetch(&hits, 1);
+	return param;
+}
+
+static void log_latency(const char *what, double timedelta)
+{
+	char msg[256];
+	sprintf(msg, "%-28s %10f us per round", what, timedelta / NBROUNDS);
+	fly_log("[test_fork_join]", msg);
+}
+
+static int run_pfor(int nbworkers)
+{
+	int errcode = FLYESUCCESS;
+	int i;
+	double timestart;
+
+	hits = 0;
+	timestart = get_time_in_usec();
+	for (i = 0; (i < NBROUNDS) && FLY_SUCCEEDED(errcode); i++)
+		errcode = fly_parallel_for(nbworkers, pfor_func, NULL);
+	log_latency("parallel_for(nbworkers):", get_time_diff_in_usec(timestart));
+	fly_assert(hits == NBROUNDS * nbworkers, "bad parallel_for hits");
+	return errcode;
+}
+
+static int run_task()
+{
+	int errcode = FLYESUCCESS;
+	int i;
+	double timestart;
+
+	hits = 0;
+	timestart = get_time_in_usec();
+	for (i = 0; (i < NBROUNDS) && FLY_SUCCEEDED(errcode); i++) {
+		struct fly_task *task = fly_create_task(task_func, NULL);
+		if (!task)
+			return FLYENORES;
+		errcode = fly_push_task(task);
+		if (FLY_SUCCEEDED(errcode))
+			errcode = fly_wait_task(task);
+		fly_destroy_task(task);
+	}
+	log_latency("push + wait task:", get_time_diff_in_usec(timestart));
+	fly_assert(hits == NBROUNDS, "bad task hits");
+	return errcode;
+}
+
+/*
+ * FLY_IDLE_ADAPTIVE parks at once on a single CPU, so the check that it parks
+ * after long idle periods fakes more CPUs through the sysconf libfly calls.
+ */
+static long fake_nbcpus;
+
+long sysconf(int name)
+{
+	static long (*real_sysconf)(int);
+	if ((name == _SC_NPROCESSORS_ONLN) && (fake_nbcpus > 0))
+		return fake_nbcpus;
+	if (!real_sysconf)
+		real_sysconf = (long (*)(int))dlsym(RTLD_NEXT, "sysconf");
+	return real_sysconf(name);
+}
+
+/*
+ * Workers which waited long for work park at once. The spin budget is far
+ * above the cost of a round, so spinning anyway shows up as CPU time used
+ * while the process only sleeps.
+ */
+#define ADAPTIVE_SPIN_US	50000
+#define ADAPTIVE_IDLE_US	150000
+#define ADAPTIVE_WARMUP		6
+#define ADAPTIVE_ROUNDS		4
+
+static double get_cpu_time_in_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (ts.tv_sec * 1000000.0) + (ts.tv_nsec / 1000.0);
+}
+
+static void check_adaptive_parks()
+{
+	struct fly_config config;
+	double cputime = 0.0;
+	double start;
+	char msg[256];
+	int errcode;
+	int i;
+
+	fake_nbcpus = 4;
+	fly_config_init(&config, 2);
+	config.idle_policy = FLY_IDLE_ADAPTIVE;
+	config.idle_spin_us = ADAPTIVE_SPIN_US;
+	errcode = fly_init(&config);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_init failed");
+
+	for (i = 0; i < ADAPTIVE_WARMUP + ADAPTIVE_ROUNDS; i++) {
+		errcode = fly_parallel_for(2, pfor_func, NULL);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+		start = get_cpu_time_in_usec();
+		usleep(ADAPTIVE_IDLE_US);
+		if (i >= ADAPTIVE_WARMUP)
+			cputime += get_cpu_time_in_usec() - start;
+	}
+	sprintf(msg, "adaptive idle CPU time:      %10f us per round",
+			cputime / ADAPTIVE_ROUNDS);
+	fly_log("[test_fork_join]", msg);
+	fly_assert(cputime < (ADAPTIVE_SPIN_US * ADAPTIVE_ROUNDS) / 2,
+			"FLY_IDLE_ADAPTIVE spins after long idle periods");
+
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+	fake_nbcpus = 0;
+}
+
+static const char *policy_names[] = {
+	"FLY_IDLE_PARK",
+	"FLY_IDLE_SPIN",
+	"FLY_IDLE_ADAPTIVE"
+};
+
+int main(int argc, char **argv)
+{
+	int					errcode;
+	long				nbcpus;
+	int					policy;
+	struct fly_config	config;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	for (policy = FLY_IDLE_PARK; policy <= FLY_IDLE_ADAPTIVE; policy++) {
+		fly_config_init(&config, nbcpus);
+		config.idle_policy = policy;
+		errcode = fly_init(&config);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_init failed");
+		fly_log("[test_fork_join]", policy_names[policy]);
+
+		errcode = run_pfor(nbcpus);
+		fly_assert(FLY_SUCCEEDED(errcode), "run_pfor failed");
+		errcode = run_task();
+		fly_assert(FLY_SUCCEEDED(errcode), "run_task failed");
+
+		errcode = fly_uninit();
+		(void)errcode;
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+	}
+
+	check_adaptive_parks();
+
+	fly_log("[test_fork_join]", "All tests pass!");
+
+	return 0;
+}
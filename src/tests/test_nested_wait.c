@@ -0,0 +1,215 @@
+/******************************************************************************
+ * test_nested_wait.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <pthread.h> /* for pthread_create */
+#include <stdio.h> /* for sprintf */
+#include <time.h> /* for clock_gettime */
+#include <unistd.h> /* for sysconf, usleep */
+
+/*
+ * Every task of a binary tree pushes its two children and waits for them. A
+ * worker which blocked in the wait would leave only its backup thread, so with
+ * few workers the tree finishes only if waiting workers run the children
+ * themselves. The same tree once more with a group per level.
+ */
+#define TREE_DEPTH		12
+
+/*
+ * A worker waits for a task which sleeps while a loop of one iteration holds,
+ * so the loop stays running with nothing left to claim. The waiting worker
+ * has to sleep, not spin on the loop.
+ */
+#define NB_WORKERS		4
+#define SLEEP_USEC		300000
+
+static volatile int counter;
+static volatile int held;
+static volatile int released;
+static volatile int sleeping;
+static double waitcpu;
+
+static void *tree_func(void *param)
+{
+	long depth = (long)param;
+	struct fly_task *children[2];
+	int errcode;
+	int i;
+	__sync_add_and_fetch(&counter, 1);
+	if (depth == 0)
+		return param;
+	for (i = 0; i < 2; i++) {
+		children[i] = fly_create_task(tree_func, (void*)(depth - 1));
+		errcode = fly_push_task(children[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	}
+	errcode = fly_wait_tasks(children, 2);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	(void)errcode;
+	for (i = 0; i < 2; i++)
+		fly_destroy_task(children[i]);
+	return param;
+}
+
+static void *group_tree_func(void *param)
+{
+	long depth = (long)param;
+	struct fly_task_group *group;
+	struct fly_task *children[2];
+	int errcode;
+	int i;
+	__sync_add_and_fetch(&counter, 1);
+	if (depth == 0)
+		return param;
+	group = fly_create_task_group();
+	fly_assert(group, "fly_create_task_group failed");
+	for (i = 0; i < 2; i++) {
+		children[i] = fly_create_task(group_tree_func, (void*)(depth - 1));
+		errcode = fly_group_push_task(group, children[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_group_push_task failed");
+	}
+	errcode = fly_group_wait(group);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_wait failed");
+	(void)errcode;
+	for (i = 0; i < 2; i++)
+		fly_destroy_task(children[i]);
+	fly_destroy_task_group(group);
+	return param;
+}
+
+static void test_tree(fly_task_func func)
+{
+	struct fly_task *root = fly_create_task(func, (void*)TREE_DEPTH);
+	int errcode;
+	counter = 0;
+	errcode = fly_push_task(root);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(root);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	fly_assert(counter == (1 << (TREE_DEPTH + 1)) - 1,
+			"not every task of the tree ran");
+	(void)errcode;
+	fly_destroy_task(root);
+}
+
+static double get_thread_cpu_time_in_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (ts.tv_sec * 1000000.0) + (ts.tv_nsec / 1000.0);
+}
+
+static void hold_iteration(int index, void *ptr)
+{
+	held = 1;
+	while (!released)
+		usleep(1000);
+}
+
+static void *hold_func(void *param)
+{
+	int errcode = fly_parallel_for(1, hold_iteration, NULL);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+	(void)errcode;
+	return param;
+}
+
+static void *sleep_func(void *param)
+{
+	sleeping = 1;
+	usleep(SLEEP_USEC);
+	return param;
+}
+
+static void *wait_func(void *param)
+{
+	double start = get_thread_cpu_time_in_usec();
+	int errcode = fly_wait_task((struct fly_task*)param);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	(void)errcode;
+	waitcpu = get_thread_cpu_time_in_usec() - start;
+	return param;
+}
+
+static void test_wait_sleeps()
+{
+	struct fly_task *sleeper = fly_create_task(sleep_func, NULL);
+	struct fly_task *waiter = fly_create_task(wait_func, sleeper);
+	pthread_t holder;
+	char msg[256];
+	int errcode;
+
+	errcode = fly_simple_init(NB_WORKERS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+	held = 0;
+	released = 0;
+	sleeping = 0;
+	pthread_create(&holder, NULL, hold_func, NULL);
+	while (!held)
+		usleep(1000);
+	errcode = fly_push_task(sleeper);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	while (!sleeping)
+		usleep(1000);
+	errcode = fly_push_task(waiter);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(waiter);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	released = 1;
+	pthread_join(holder, NULL);
+	sprintf(msg, "wait CPU time:\t%f us", waitcpu);
+	fly_log("[test_nested_wait]", msg);
+	fly_assert(waitcpu < SLEEP_USEC / 4, "waiting worker spins");
+	fly_destroy_task(waiter);
+	fly_destroy_task(sleeper);
+
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+}
+
+int main(int argc, char **argv)
+{
+	int errcode;
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	test_tree(tree_func);
+	test_tree(group_tree_func);
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	test_wait_sleeps();
+
+	fly_log("[test_nested_wait]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/******************************************************************************
+ * test_numa.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <unistd.h> /* for sysconf */
+
+/*
+ * FLY_PFOR_NODE runs every iteration once, with simulated NUMA nodes and with
+ * the nodes of the machine.
+ */
+#define DATA_SIZE	4096
+#define TEST_GRAIN	16
+#define SIM_NODES	2
+
+int hitarr[DATA_SIZE];
+int indarr[DATA_SIZE];
+
+static void hit_index(int ind, void *ptr)
+{
+	__sync_add_and_fetch(&hitarr[ind], 1);
+}
+
+static void hit_element(int ind, void *ptr)
+{
+	__sync_add_and_fetch(&hitarr[*(int*)ptr], 1);
+}
+
+static void clean_data()
+{
+	int i;
+	for (i = 0; i < DATA_SIZE; i++) {
+		hitarr[i] = 0;
+		indarr[i] = i;
+	}
+}
+
+static int validate_data(const char *name)
+{
+	int i;
+	int goterr = 0;
+	for (i = 0; i < DATA_SIZE; i++) {
+		if (hitarr[i] != 1) {
+			char msg[256] = {0};
+			sprintf(msg, "%s failing index %d; executed %d times", name, i,
+					hitarr[i]);
+			fly_log("[test_numa]", msg);
+			goterr = 1;
+		}
+	}
+	return !goterr;
+}
+
+static void test_node_schedule(int grain)
+{
+	int errcode;
+
+	clean_data();
+	errcode = fly_parallel_for_ex(DATA_SIZE, hit_index, NULL,
+			FLY_PFOR_NODE, grain);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for_ex failed");
+	errcode = validate_data("parallel_for_ex");
+	fly_assert(errcode, "fly_parallel_for_ex not valid result");
+
+	clean_data();
+	errcode = fly_parallel_for_arr_ex(0, DATA_SIZE, hit_element, indarr,
+			sizeof(int), FLY_PFOR_NODE, grain);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for_arr_ex failed");
+	errcode = validate_data("parallel_for_arr_ex");
+	fly_assert(errcode, "fly_parallel_for_arr_ex not valid result");
+	(void)errcode;
+}
+
+static void test_config(int nbworkers, int pin, int numanodes)
+{
+	int errcode;
+	struct fly_config config;
+
+	fly_config_init(&config, nbworkers);
+	config.pin_workers = pin;
+	config.numa_nodes = numanodes;
+	errcode = fly_init(&config);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_init failed");
+
+	test_node_schedule(0);
+	test_node_schedule(TEST_GRAIN);
+
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+}
+
+int main(int argc, char **argv)
+{
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 2)
+		nbcpus = 2; /* at least one worker per simulated node */
+
+	test_config(nbcpus * SIM_NODES, 0, SIM_NODES);
+	test_config(nbcpus, 1, 0);
+
+	fly_log("[test_numa]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+/******************************************************************************
+ * test_parallel_for_ex.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <unistd.h> /* for sysconf */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+#define DATA_SIZE		1024
+#define WORK_PER_INDEX	2000
+#define TEST_GRAIN		4
+
+int resarr[DATA_SIZE];
+int hitarr[DATA_SIZE];
+
+/* the cost of every index grows with the index - bad for static batches */
+static int irregular_work(int ind)
+{
+	int res = 0;
+	int i;
+	for (i = 0; i < (ind * WORK_PER_INDEX) / DATA_SIZE; i++)
+		res = (res * 31 + i) % 1000003;
+	return res;
+}
+
+static void irregular_parallel(int ind, void *ptr)
+{
+	resarr[ind] = irregular_work(ind);
+	__sync_add_and_fetch(&hitarr[ind], 1);
+}
+
+static void clean_data()
+{
+	int i;
+	for (i = 0; i < DATA_SIZE; i++) {
+		resarr[i] = -1;
+		hitarr[i] = 0;
+	}
+}
+
+static int validate_data()
+{
+	int i;
+	int goterr = 0;
+	for (i = 0; i < DATA_SIZE; i++) {
+		if ((hitarr[i] != 1) || (resarr[i] != irregular_work(i))) {
+			char msg[256] = {0};
+			sprintf(msg, "failing index %d; executed %d times", i, hitarr[i]);
+			fly_log("[test_parallel_for_ex]", msg);
+			goterr = 1;
+		}
+	}
+	return !goterr;
+}
+
+static int test_schedule(enum fly_pfor_schedule schedule, int grain,
+		const char *name)
+{
+	int errcode;
+	double timestart;
+	double timedelta;
+	char msg[256];
+
+	clean_data();
+	timestart = get_time_in_usec();
+	errcode = fly_parallel_for_ex(DATA_SIZE, irregular_parallel, NULL,
+			schedule, grain);
+	timedelta = get_time_diff_in_usec(timestart);
+	sprintf(msg, "%s grain %d took: %f us", name, grain, timedelta);
+	fly_log("[test_parallel_for_ex]", msg);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for_ex failed");
+	errcode = validate_data();
+	fly_assert(errcode, "fly_parallel_for_ex not valid result");
+	return errcode;
+}
+
+int main(int argc, char **argv)
+{
+	int errcode = FLYESUCCESS;
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	test_schedule(FLY_PFOR_STATIC, 0, "static ");
+	test_schedule(FLY_PFOR_STATIC, TEST_GRAIN, "static ");
+	test_schedule(FLY_PFOR_DYNAMIC, 0, "dynamic");
+	test_schedule(FLY_PFOR_DYNAMIC, TEST_GRAIN, "dynamic");
+	test_schedule(FLY_PFOR_GUIDED, 0, "guided ");
+	test_schedule(FLY_PFOR_GUIDED, TEST_GRAIN, "guided ");
+	test_schedule(FLY_PFOR_ADAPTIVE, 0, "adaptive");
+	test_schedule(FLY_PFOR_ADAPTIVE, TEST_GRAIN, "adaptive");
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_parallel_for_ex]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,160 @@
+/******************************************************************************
+ * test_parallel_range.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <unistd.h> /* for sysconf */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+#define DATA_SIZE		(1 << 22)
+#define DATA_START		3
+#define SAXPY_A			2.f
+
+float xarr[DATA_SIZE];
+float yarr[DATA_SIZE];
+
+static void init_data()
+{
+	int i;
+	for (i = 0; i < DATA_SIZE; i++) {
+		xarr[i] = (float)(i % 1024);
+		yarr[i] = 1.f;
+	}
+}
+
+static int validate_data(int start, int end, float expected_mult)
+{
+	int i;
+	int goterr = 0;
+	for (i = 0; i < DATA_SIZE; i++) {
+		float expected = 1.f;
+		if ((i >= start) && (i < end))
+			expected += expected_mult * (float)(i % 1024);
+		if (yarr[i] != expected) {
+			char msg[256] = {0};
+			sprintf(msg, "failing index %d; got: %f; expected: %f",
+					i, yarr[i], expected);
+			fly_log("[test_parallel_range]", msg);
+			goterr = 1;
+			break;
+		}
+	}
+	return !goterr;
+}
+
+static void saxpy_index(int ind, void *ptr)
+{
+	yarr[ind] += SAXPY_A * xarr[ind];
+}
+
+static void saxpy_range(int start, int end, void *ptr)
+{
+	int i;
+	for (i = start; i < end; i++)
+		yarr[i] += SAXPY_A * xarr[i];
+}
+
+static void saxpy_range_arr(int start, int end, void *arr)
+{
+	float *x = (float*)arr;
+	float *y = yarr + start;
+	int count = end - start;
+	int i;
+	for (i = 0; i < count; i++)
+		y[i] += SAXPY_A * x[i];
+}
+
+int main(int argc, char **argv)
+{
+	int errcode = FLYESUCCESS;
+	double timestart;
+	double timedelta;
+	char msg[256];
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	init_data();
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	timestart = get_time_in_usec();
+	errcode = fly_parallel_for(DATA_SIZE, saxpy_index, NULL);
+	timedelta = get_time_diff_in_usec(timestart);
+	sprintf(msg, "parallel for per index took: %f us", timedelta);
+	fly_log("[test_parallel_range]", msg);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+	errcode = validate_data(0, DATA_SIZE, SAXPY_A);
+	fly_assert(errcode, "fly_parallel_for not valid result");
+
+	init_data();
+	timestart = get_time_in_usec();
+	errcode = fly_parallel_for_range(DATA_START, DATA_SIZE, saxpy_range, NULL);
+	timedelta = get_time_diff_in_usec(timestart);
+	sprintf(msg, "parallel for range took:     %f us", timedelta);
+	fly_log("[test_parallel_range]", msg);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for_range failed");
+	errcode = validate_data(DATA_START, DATA_SIZE, SAXPY_A);
+	fly_assert(errcode, "fly_parallel_for_range not valid result");
+
+	init_data();
+	timestart = get_time_in_usec();
+	errcode = fly_parallel_for_range_arr(DATA_START, DATA_SIZE,
+			saxpy_range_arr, xarr, sizeof(float));
+	timedelta = get_time_diff_in_usec(timestart);
+	sprintf(msg, "parallel for range arr took: %f us", timedelta);
+	fly_log("[test_parallel_range]", msg);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for_range_arr failed");
+	errcode = validate_data(DATA_START, DATA_SIZE, SAXPY_A);
+	fly_assert(errcode, "fly_parallel_for_range_arr not valid result");
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_parallel_range]", "All tests pass!");
+
+	return 0;
+}
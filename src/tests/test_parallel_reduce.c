@@ -0,0 +1,137 @@
+/******************************************************************************
+ * test_parallel_reduce.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <string.h> /* for memcmp */
+#include <unistd.h> /* for sysconf */
+
+/*
+ * Integer sums must match the sequential sum in both modes, floating point
+ * sums of FLY_REDUCE_DETERMINISTIC must not change with the number of workers.
+ */
+#define DATA_SIZE	100000
+#define TEST_GRAIN	777
+
+double values[DATA_SIZE];
+
+static void sum_ints(int start, int end, void *partial, void *ptr)
+{
+	long long *sum = partial;
+	int i;
+	for (i = start; i < end; i++)
+		*sum += i;
+}
+
+static void add_ints(void *dst, const void *src, void *ptr)
+{
+	*(long long*)dst += *(const long long*)src;
+}
+
+static void sum_doubles(int start, int end, void *partial, void *ptr)
+{
+	double *sum = partial;
+	double *arr = ptr;
+	int i;
+	for (i = start; i < end; i++)
+		*sum += arr[i];
+}
+
+static void add_doubles(void *dst, const void *src, void *ptr)
+{
+	*(double*)dst += *(const double*)src;
+}
+
+/* values of very different magnitude - the sum depends on the order */
+static void init_values()
+{
+	unsigned int seed = 12345;
+	int i;
+	for (i = 0; i < DATA_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		values[i] = ((seed >> 8) % 1000) * ((i % 7) ? 1e-6 : 1e6);
+	}
+}
+
+static void test_int_sum(enum fly_reduce_mode mode, int grain)
+{
+	long long identity = 0;
+	long long sum = -1;
+	long long expected = ((long long)DATA_SIZE * (DATA_SIZE - 1)) / 2;
+	int errcode;
+	errcode = fly_parallel_reduce_ex(0, DATA_SIZE, &identity, sizeof(identity),
+			sum_ints, add_ints, NULL, &sum, mode, grain);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_reduce_ex failed");
+	fly_assert(sum == expected, "fly_parallel_reduce_ex wrong sum");
+	(void)errcode;
+}
+
+static double double_sum(int nbworkers)
+{
+	double identity = 0.0;
+	double sum = 0.0;
+	int errcode;
+
+	errcode = fly_simple_init(nbworkers);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	test_int_sum(FLY_REDUCE_FAST, 0);
+	test_int_sum(FLY_REDUCE_FAST, TEST_GRAIN);
+	test_int_sum(FLY_REDUCE_DETERMINISTIC, 0);
+	test_int_sum(FLY_REDUCE_DETERMINISTIC, TEST_GRAIN);
+
+	errcode = fly_parallel_reduce_ex(0, DATA_SIZE, &identity, sizeof(identity),
+			sum_doubles, add_doubles, values, &sum, FLY_REDUCE_DETERMINISTIC,
+			0);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_reduce_ex failed");
+
+	errcode = fly_uninit();
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+	(void)errcode;
+	return sum;
+}
+
+int main(int argc, char **argv)
+{
+	long nbcpus;
+	double first;
+	int nbworkers;
+	char msg[256];
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	init_values();
+	first = double_sum(1);
+	for (nbworkers = 2; nbworkers <= (2 * nbcpus) + 1; nbworkers++) {
+		double sum = double_sum(nbworkers);
+		sprintf(msg, "%d workers sum %.17g", nbworkers, sum);
+		fly_log("[test_parallel_reduce]", msg);
+		fly_assert(memcmp(&sum, &first, sizeof(double)) == 0,
+				"deterministic sum differs");
+	}
+
+	fly_log("[test_parallel_reduce]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+/******************************************************************************
+ * test_parallel_scan.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <string.h> /* for memcmp */
+#include <unistd.h> /* for sysconf */
+
+/*
+ * Scans are checked against a sequential scan, in and out of place. The 2x2
+ * matrix product does not commute, so it catches operands in wrong order.
+ */
+#define DATA_SIZE	100003
+#define SMALL_SIZE	100
+#define MOD			1000003
+
+struct matrix {
+	long long	m[4];
+}; /* struct matrix */
+
+struct matrix inarr[DATA_SIZE];
+struct matrix outarr[DATA_SIZE];
+struct matrix expected[DATA_SIZE];
+static const struct matrix identity = {{1, 0, 0, 1}};
+
+static void mul_matrix(void *acc, const void *el, void *ptr)
+{
+	struct matrix *a = acc;
+	const struct matrix *b = el;
+	struct matrix r;
+	r.m[0] = (a->m[0] * b->m[0] + a->m[1] * b->m[2]) % MOD;
+	r.m[1] = (a->m[0] * b->m[1] + a->m[1] * b->m[3]) % MOD;
+	r.m[2] = (a->m[2] * b->m[0] + a->m[3] * b->m[2]) % MOD;
+	r.m[3] = (a->m[2] * b->m[1] + a->m[3] * b->m[3]) % MOD;
+	*a = r;
+}
+
+static void init_data(int count)
+{
+	unsigned int seed = 4321;
+	int i;
+	for (i = 0; i < count; i++) {
+		int j;
+		for (j = 0; j < 4; j++) {
+			seed = seed * 1103515245 + 12345;
+			inarr[i].m[j] = (seed >> 8) % MOD;
+		}
+	}
+}
+
+static void seq_scan(int start, int end, enum fly_scan_type type)
+{
+	struct matrix acc = identity;
+	int i;
+	for (i = start; i < end; i++) {
+		if (type == FLY_SCAN_EXCLUSIVE)
+			expected[i] = acc;
+		mul_matrix(&acc, &inarr[i], NULL);
+		if (type == FLY_SCAN_INCLUSIVE)
+			expected[i] = acc;
+	}
+}
+
+static void test_scan(int start, int end, enum fly_scan_type type,
+		int inplace)
+{
+	struct matrix *out = inplace ? inarr : outarr;
+	int errcode;
+	char msg[256];
+
+	init_data(end);
+	seq_scan(start, end, type);
+	errcode = fly_parallel_scan(start, end, inarr, out, sizeof(struct matrix),
+			&identity, mul_matrix, NULL, type);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_scan failed");
+	errcode = (memcmp(out + start, expected + start,
+				(end - start) * sizeof(struct matrix)) == 0);
+	sprintf(msg, "[%d, %d) %s%s: %s", start, end,
+			(type == FLY_SCAN_INCLUSIVE) ? "inclusive" : "exclusive",
+			inplace ? " in place" : "", errcode ? "ok" : "wrong");
+	fly_log("[test_parallel_scan]", msg);
+	fly_assert(errcode, "fly_parallel_scan not valid result");
+}
+
+int main(int argc, char **argv)
+{
+	int errcode;
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	test_scan(0, DATA_SIZE, FLY_SCAN_INCLUSIVE, 0);
+	test_scan(0, DATA_SIZE, FLY_SCAN_EXCLUSIVE, 0);
+	test_scan(7, DATA_SIZE, FLY_SCAN_INCLUSIVE, 1);
+	test_scan(7, DATA_SIZE, FLY_SCAN_EXCLUSIVE, 1);
+	test_scan(0, SMALL_SIZE, FLY_SCAN_INCLUSIVE, 0);
+	test_scan(0, SMALL_SIZE, FLY_SCAN_EXCLUSIVE, 1);
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_parallel_scan]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+/******************************************************************************
+ * test_parallel_sort.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <stdlib.h> /* for qsort */
+#include <string.h> /* for memcpy */
+#include <unistd.h> /* for sysconf */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+/*
+ * Sorts records against qsort - the same keys in the same order. The timing
+ * of qsort and fly_parallel_sort is logged for 1 to nbcpus workers.
+ */
+#define DATA_SIZE		(1 << 21)
+#define SMALL_SIZE		10007
+#define SMALL_CUTOFF	100
+#define KEY_RANGE		(1 << 16) /* plenty of equal keys */
+
+struct record {
+	int		key;
+	int		payload[3];
+}; /* struct record */
+
+struct record data[DATA_SIZE];
+struct record sorted[DATA_SIZE];
+struct record expected[DATA_SIZE];
+
+static int cmp_records(const void *a, const void *b)
+{
+	const struct record *ra = a;
+	const struct record *rb = b;
+	return (ra->key > rb->key) - (ra->key < rb->key);
+}
+
+static void init_data()
+{
+	unsigned int seed = 2013;
+	int i;
+	for (i = 0; i < DATA_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i].key = (seed >> 8) % KEY_RANGE;
+		data[i].payload[0] = i;
+		data[i].payload[1] = -i;
+		data[i].payload[2] = data[i].key;
+	}
+}
+
+/* keys in order and every record still whole */
+static int validate(int nb)
+{
+	int i;
+	for (i = 0; i < nb; i++) {
+		if ((sorted[i].key != expected[i].key) ||
+				(sorted[i].payload[2] != sorted[i].key) ||
+				(sorted[i].payload[1] != -sorted[i].payload[0]))
+			return 0;
+	}
+	return 1;
+}
+
+static double time_qsort(int nb)
+{
+	double timestart;
+	memcpy(expected, data, nb * sizeof(struct record));
+	timestart = get_time_in_usec();
+	qsort(expected, nb, sizeof(struct record), cmp_records);
+	return get_time_diff_in_usec(timestart);
+}
+
+static double time_sort(int nb, int cutoff)
+{
+	double timestart;
+	double timedelta;
+	int errcode;
+	memcpy(sorted, data, nb * sizeof(struct record));
+	timestart = get_time_in_usec();
+	errcode = fly_parallel_sort_ex(sorted, nb, sizeof(struct record),
+			cmp_records, cutoff);
+	timedelta = get_time_diff_in_usec(timestart);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_sort_ex failed");
+	errcode = validate(nb);
+	fly_assert(errcode, "fly_parallel_sort_ex not valid result");
+	(void)errcode;
+	return timedelta;
+}
+
+int main(int argc, char **argv)
+{
+	int errcode;
+	long nbcpus;
+	double qsorttime;
+	int nbworkers;
+	char msg[256];
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	init_data();
+	qsorttime = time_qsort(DATA_SIZE);
+	sprintf(msg, "qsort %d records took: %f us", DATA_SIZE, qsorttime);
+	fly_log("[test_parallel_sort]", msg);
+
+	for (nbworkers = 1; nbworkers <= nbcpus; nbworkers++) {
+		double sorttime;
+		errcode = fly_simple_init(nbworkers);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+		time_qsort(SMALL_SIZE);
+		time_sort(SMALL_SIZE, SMALL_CUTOFF);
+		time_qsort(1);
+		time_sort(1, 0);
+
+		time_qsort(DATA_SIZE);
+		sorttime = time_sort(DATA_SIZE, 0);
+		sprintf(msg, "%2d workers took: %f us; speed bump: %f", nbworkers,
+				sorttime, qsorttime / sorttime);
+		fly_log("[test_parallel_sort]", msg);
+
+		errcode = fly_uninit();
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+	}
+	(void)errcode;
+
+	fly_log("[test_parallel_sort]", "All tests pass!");
+
+	return 0;
+}
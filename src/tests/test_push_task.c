@@ -122,6 +122,7 @@ int main(int argc, char **argv)
 	double				timedelta;
 	double				olddelta;
 	char				msg[256] = {0};
+	struct fly_pool_stats	poolstats;
 
 	int					counter;
 	struct fly_task		*tasks[NBTASKS];
@@ -183,6 +184,12 @@ int main(int argc, char **argv)
 	sprintf(msg, "speed bump:\t\t\t%f", timedelta / olddelta);
 	fly_log("[test_push_task]", msg);
 
+	fly_get_pool_stats(&poolstats);
+	sprintf(msg, "pools hits/misses: jobs %lu/%lu; tasks %lu/%lu",
+			poolstats.job_hits, poolstats.job_misses,
+			poolstats.task_hits, poolstats.task_misses);
+	fly_log("[test_push_task]", msg);
+
 	/* shutdown libfly */
 	errcode = fly_uninit();
 	(void)errcode;
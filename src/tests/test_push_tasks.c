@@ -0,0 +1,153 @@
+/******************************************************************************
+ * test_push_tasks.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <unistd.h> /* for sysconf */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+/*
+ * Every task pushed in bulk runs once with its own param, from the main thread
+ * and from a worker. The time of a bulk push is compared to pushing the same
+ * tasks one by one.
+ */
+#define NB_TASKS		4096
+
+static int params[NB_TASKS];
+static volatile int hits[NB_TASKS];
+struct fly_task *tasks[NB_TASKS];
+
+static void *task_func(void *param)
+{
+	__sync_add_and_fetch(&hits[*(int*)param], 1);
+	return param;
+}
+
+static void check_hits()
+{
+	int i;
+	for (i = 0; i < NB_TASKS; i++) {
+		fly_assert(hits[i] == 1, "task did not run once");
+		fly_assert(fly_get_task_result(tasks[i]) == &params[i],
+				"task got a wrong param");
+		hits[i] = 0;
+	}
+}
+
+static double push_wait(int bulk)
+{
+	double time = get_time_in_usec();
+	int errcode = FLYESUCCESS;
+	int i;
+	if (bulk) {
+		errcode = fly_push_tasks(tasks, NB_TASKS);
+	} else {
+		for (i = 0; (i < NB_TASKS) && FLY_SUCCEEDED(errcode); i++)
+			errcode = fly_push_task(tasks[i]);
+	}
+	fly_assert(FLY_SUCCEEDED(errcode), "pushing the tasks failed");
+	errcode = fly_wait_tasks(tasks, NB_TASKS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	(void)errcode;
+	return get_time_diff_in_usec(time);
+}
+
+static void *push_from_worker(void *param)
+{
+	push_wait(1);
+	return param;
+}
+
+int main(int argc, char **argv)
+{
+	struct fly_task *parent;
+	double time;
+	char buf[128];
+	int errcode;
+	long nbcpus;
+	int i;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	for (i = 0; i < NB_TASKS; i++)
+		params[i] = i;
+	errcode = fly_create_tasks(tasks, task_func, params, sizeof(int),
+			NB_TASKS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_create_tasks failed");
+
+	/* fills the job pools, so both timed rounds reuse the jobs */
+	push_wait(1);
+	check_hits();
+
+	time = push_wait(0);
+	check_hits();
+	sprintf(buf, "%d tasks pushed one by one:\t%f us", NB_TASKS, time);
+	fly_log("[test_push_tasks]", buf);
+
+	time = push_wait(1);
+	check_hits();
+	sprintf(buf, "%d tasks pushed in bulk:\t%f us", NB_TASKS, time);
+	fly_log("[test_push_tasks]", buf);
+
+	parent = fly_create_task(push_from_worker, NULL);
+	errcode = fly_push_task(parent);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(parent);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	check_hits();
+	fly_destroy_task(parent);
+
+	fly_destroy_tasks(tasks, NB_TASKS);
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_push_tasks]", "All tests pass!");
+
+	return 0;
+}
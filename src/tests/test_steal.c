@@ -0,0 +1,176 @@
+/******************************************************************************
+ * test_steal.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <pthread.h> /* for pthread_create */
+#include <unistd.h> /* for usleep */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+/*
+ * A thread runs a loop of one iteration which holds until the end, so the
+ * loop stays on the running list with nothing left to claim. Meanwhile the
+ * children pushed by a task must be stolen - they wait for each other, one
+ * thread running them in turn times out - and a low priority task must run.
+ */
+#define NB_WORKERS		4
+#define NB_CHILDREN		3
+#define WAIT_USEC		1000000.0
+
+static volatile int held;
+static volatile int released;
+static volatile int arrived;
+static volatile int timedout;
+static volatile int lowran;
+
+static void hold_iteration(int index, void *ptr)
+{
+	held = 1;
+	while (!released)
+		usleep(1000);
+}
+
+static void *hold_func(void *param)
+{
+	int errcode = fly_parallel_for(1, hold_iteration, NULL);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+	(void)errcode;
+	return param;
+}
+
+static void *child_func(void *param)
+{
+	double time = get_time_in_usec();
+	__sync_add_and_fetch(&arrived, 1);
+	while (arrived < NB_CHILDREN) {
+		if (get_time_diff_in_usec(time) > WAIT_USEC) {
+			timedout = 1;
+			break;
+		}
+		usleep(1000);
+	}
+	return param;
+}
+
+/* the children go to the deque of the worker running the parent */
+static void *parent_func(void *param)
+{
+	struct fly_task *children[NB_CHILDREN];
+	int errcode;
+	int i;
+	for (i = 0; i < NB_CHILDREN; i++) {
+		children[i] = fly_create_task(child_func, NULL);
+		errcode = fly_push_task(children[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	}
+	errcode = fly_wait_tasks(children, NB_CHILDREN);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	(void)errcode;
+	for (i = 0; i < NB_CHILDREN; i++)
+		fly_destroy_task(children[i]);
+	return param;
+}
+
+static void *low_func(void *param)
+{
+	lowran = 1;
+	return param;
+}
+
+static void test_steal()
+{
+	struct fly_task *parent = fly_create_task(parent_func, NULL);
+	int errcode;
+	arrived = 0;
+	timedout = 0;
+	errcode = fly_push_task(parent);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(parent);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	(void)errcode;
+	fly_assert(arrived == NB_CHILDREN, "not every child ran");
+	fly_assert(!timedout, "children were not stolen while a loop ran");
+	fly_destroy_task(parent);
+}
+
+static void test_low()
+{
+	struct fly_task *low = fly_create_task(low_func, NULL);
+	double time = get_time_in_usec();
+	int errcode;
+	lowran = 0;
+	errcode = fly_push_task_prio(low, FLY_PRIO_LOW);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task_prio failed");
+	while (!lowran && (get_time_diff_in_usec(time) < WAIT_USEC))
+		usleep(1000);
+	fly_assert(lowran, "low task did not run while a loop ran");
+	errcode = fly_wait_task(low);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	(void)errcode;
+	fly_destroy_task(low);
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t holder;
+	int errcode;
+
+	errcode = fly_simple_init(NB_WORKERS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	held = 0;
+	released = 0;
+	pthread_create(&holder, NULL, hold_func, NULL);
+	while (!held)
+		usleep(1000);
+	test_steal();
+	test_low();
+	released = 1;
+	pthread_join(holder, NULL);
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_steal]", "All tests pass!");
+
+	return 0;
+}
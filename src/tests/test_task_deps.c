@@ -0,0 +1,192 @@
+/******************************************************************************
+ * test_task_deps.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <unistd.h> /* for sysconf */
+
+/*
+ * A chain has to run in order, a join only after all its dependencies, also
+ * when the graph is built from a task and when a dependency was waited for.
+ */
+#define CHAIN_LEN		64
+#define FAN_IN			32
+#define SPIN_LOOP_SIZE	10000
+
+static volatile int counter;
+static int order[CHAIN_LEN];
+static volatile int leaves_done;
+static int leaves_seen;
+
+struct fly_task *chain[CHAIN_LEN];
+struct fly_task *leaves[FAN_IN];
+int indexes[CHAIN_LEN];
+
+static void *chain_func(void *param)
+{
+	int pos = __sync_fetch_and_add(&counter, 1);
+	order[pos] = *(int*)param;
+	return param;
+}
+
+static void *leaf_func(void *param)
+{
+	volatile int i;
+	for (i = 0; i < SPIN_LOOP_SIZE; i++)
+		;
+	__sync_add_and_fetch(&leaves_done, 1);
+	return param;
+}
+
+static void *join_func(void *param)
+{
+	leaves_seen = leaves_done;
+	return param;
+}
+
+static void push_chain()
+{
+	int i;
+	int errcode;
+	counter = 0;
+	for (i = 0; i < CHAIN_LEN; i++) {
+		indexes[i] = i;
+		chain[i] = fly_create_task(chain_func, &indexes[i]);
+		fly_assert(chain[i], "fly_create_task failed");
+	}
+	errcode = fly_push_task(chain[0]);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	for (i = 1; i < CHAIN_LEN; i++) {
+		errcode = fly_task_then(chain[i - 1], chain[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_task_then failed");
+	}
+	(void)errcode;
+}
+
+static void wait_chain()
+{
+	int i;
+	int errcode = fly_wait_tasks(chain, CHAIN_LEN);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	(void)errcode;
+	for (i = 0; i < CHAIN_LEN; i++) {
+		fly_assert(order[i] == i, "chain out of order");
+		fly_destroy_task(chain[i]);
+	}
+}
+
+static void test_chain()
+{
+	push_chain();
+	wait_chain();
+}
+
+static void test_fan_in()
+{
+	struct fly_task *join;
+	int errcode;
+	int i;
+	leaves_done = 0;
+	leaves_seen = -1;
+	for (i = 0; i < FAN_IN; i++) {
+		leaves[i] = fly_create_task(leaf_func, NULL);
+		errcode = fly_push_task(leaves[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	}
+	join = fly_create_task(join_func, NULL);
+	errcode = fly_push_task_after(join, leaves, FAN_IN);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task_after failed");
+	errcode = fly_wait_task(join);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	fly_assert(leaves_seen == FAN_IN, "join ran before its dependencies");
+	errcode = fly_wait_tasks(leaves, FAN_IN);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	(void)errcode;
+	for (i = 0; i < FAN_IN; i++)
+		fly_destroy_task(leaves[i]);
+	fly_destroy_task(join);
+}
+
+static void *build_chain_func(void *param)
+{
+	push_chain();
+	return param;
+}
+
+static void test_chain_from_task()
+{
+	struct fly_task *builder = fly_create_task(build_chain_func, NULL);
+	int errcode = fly_push_task(builder);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(builder);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	(void)errcode;
+	fly_destroy_task(builder);
+	wait_chain();
+}
+
+static void test_waited_dep()
+{
+	struct fly_task *pred = fly_create_task(leaf_func, NULL);
+	struct fly_task *succ = fly_create_task(join_func, NULL);
+	int errcode;
+	leaves_done = 0;
+	leaves_seen = -1;
+	errcode = fly_push_task(pred);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(pred);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	errcode = fly_task_then(pred, succ);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_task_then failed");
+	errcode = fly_wait_task(succ);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	fly_assert(leaves_seen == 1, "successor of a waited task did not run");
+	(void)errcode;
+	fly_destroy_task(pred);
+	fly_destroy_task(succ);
+}
+
+int main(int argc, char **argv)
+{
+	int errcode;
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	test_chain();
+	test_fan_in();
+	test_chain_from_task();
+	test_waited_dep();
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_task_deps]", "All tests pass!");
+
+	return 0;
+}
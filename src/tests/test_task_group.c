@@ -0,0 +1,352 @@
+/******************************************************************************
+ * test_task_group.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <pthread.h> /* for pthread_create */
+#include <stdio.h> /* for sprintf */
+#include <time.h> /* for clock_gettime */
+#include <unistd.h> /* for sysconf, usleep */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+/*
+ * Every task of a group runs once before fly_group_wait returns, a timed wait
+ * gives up on a task held back by a gate and a cancelled group skips the tasks
+ * which did not start. The tasks wait in blocking regions, so the others run
+ * on the backup thread of their worker when there is only one. A task with a
+ * queue is not pushed to a group, a grouped task is not a dependency.
+ */
+#define NB_TASKS		4096
+
+/*
+ * A worker waits for a group whose task sleeps while a loop of one iteration
+ * holds, so the loop stays running with nothing left to claim. The waiting
+ * worker has to sleep on the counter of the group, not spin on the loop.
+ */
+#define NB_WORKERS		4
+#define SLEEP_USEC		300000
+
+static volatile int counter;
+static volatile int gate;
+static volatile int started;
+static volatile int held;
+static volatile int released;
+static double waitcpu;
+struct fly_task *tasks[NB_TASKS];
+
+static void *count_func(void *param)
+{
+	__sync_add_and_fetch(&counter, 1);
+	return param;
+}
+
+static void *gated_func(void *param)
+{
+	fly_blocking_begin();
+	while (!gate)
+		usleep(100);
+	fly_blocking_end();
+	return param;
+}
+
+static void *until_cancel_func(void *param)
+{
+	struct fly_task_group *group = param;
+	started = 1;
+	fly_blocking_begin();
+	while (!fly_group_is_cancelled(group))
+		usleep(100);
+	fly_blocking_end();
+	return param;
+}
+
+static void push_all(struct fly_task_group *group)
+{
+	int i;
+	int errcode;
+	for (i = 0; i < NB_TASKS; i++) {
+		errcode = fly_group_push_task(group, tasks[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_group_push_task failed");
+	}
+	(void)errcode;
+}
+
+static void test_group()
+{
+	struct fly_task_group *group = fly_create_task_group();
+	double time;
+	char buf[128];
+	int errcode;
+	int i;
+	fly_assert(group, "fly_create_task_group failed");
+	errcode = fly_group_wait(group);
+	fly_assert(FLY_SUCCEEDED(errcode), "wait on an empty group failed");
+
+	/* twice - a waited group and its tasks can be used again */
+	for (i = 0; i < 2; i++) {
+		counter = 0;
+		time = get_time_in_usec();
+		push_all(group);
+		errcode = fly_group_wait(group);
+		time = get_time_diff_in_usec(time);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_group_wait failed");
+		fly_assert(counter == NB_TASKS, "group task did not run once");
+		fly_assert(fly_task_is_done(tasks[NB_TASKS - 1]), "task not done");
+	}
+	sprintf(buf, "%d tasks in a group took:\t%f us", NB_TASKS, time);
+	fly_log("[test_task_group]", buf);
+
+	counter = 0;
+	time = get_time_in_usec();
+	for (i = 0; i < NB_TASKS; i++) {
+		errcode = fly_push_task(tasks[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	}
+	errcode = fly_wait_tasks(tasks, NB_TASKS);
+	time = get_time_diff_in_usec(time);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	fly_assert(counter == NB_TASKS, "task did not run once");
+	sprintf(buf, "%d tasks waited for one by one took:\t%f us", NB_TASKS,
+			time);
+	fly_log("[test_task_group]", buf);
+	(void)errcode;
+	fly_destroy_task_group(group);
+}
+
+static void test_timed_wait()
+{
+	struct fly_task_group *group = fly_create_task_group();
+	struct fly_task *gated = fly_create_task(gated_func, NULL);
+	int errcode;
+	gate = 0;
+	errcode = fly_group_push_task(group, gated);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_push_task failed");
+	errcode = fly_group_timed_wait(group, 0);
+	fly_assert(errcode == FLYETIMEDOUT, "timed wait did not time out");
+	errcode = fly_group_timed_wait(group, 2000);
+	fly_assert(errcode == FLYETIMEDOUT, "timed wait did not time out");
+	gate = 1;
+	errcode = fly_group_timed_wait(group, 10000000);
+	fly_assert(FLY_SUCCEEDED(errcode), "timed wait failed");
+	(void)errcode;
+	fly_destroy_task(gated);
+	fly_destroy_task_group(group);
+}
+
+static void test_cancel()
+{
+	struct fly_task_group *group = fly_create_task_group();
+	struct fly_task *running = fly_create_task(until_cancel_func, group);
+	int errcode;
+	int i;
+	started = 0;
+	errcode = fly_group_push_task(group, running);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_push_task failed");
+	fly_assert(!fly_group_is_cancelled(group), "new group is cancelled");
+	while (!started)
+		usleep(100);
+	fly_group_cancel(group);
+	errcode = fly_group_wait(group);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_wait failed");
+	fly_assert(fly_get_task_result(running) == group, "started task skipped");
+
+	counter = 0;
+	push_all(group);
+	errcode = fly_group_wait(group);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_wait failed");
+	fly_assert(counter == 0, "task of a cancelled group ran");
+	for (i = 0; i < NB_TASKS; i++) {
+		fly_assert(fly_get_task_result(tasks[i]) == NULL, "skipped result");
+	}
+	(void)errcode;
+	fly_destroy_task(running);
+	fly_destroy_task_group(group);
+}
+
+/* the job of a grouped task is released on completion - nothing may hold it */
+static void test_rejected()
+{
+	struct fly_task_group *group = fly_create_task_group();
+	struct fly_task_queue *queue = fly_create_task_queue();
+	struct fly_task *queued = fly_create_task(count_func, NULL);
+	struct fly_task *grouped = fly_create_task(count_func, NULL);
+	struct fly_task *after = fly_create_task(count_func, NULL);
+	int errcode;
+	fly_task_set_queue(queued, queue);
+	errcode = fly_group_push_task(group, queued);
+	fly_assert(errcode == FLYEATTR, "task with a queue pushed to a group");
+	errcode = fly_group_push_task(group, grouped);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_push_task failed");
+	errcode = fly_task_then(grouped, after);
+	fly_assert(errcode == FLYEATTR, "grouped task used as a dependency");
+	errcode = fly_group_wait(group);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_wait failed");
+	/* pushed on its own again it may be a dependency */
+	errcode = fly_push_task(grouped);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_task_then(grouped, after);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_task_then failed");
+	errcode = fly_wait_task(after);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	errcode = fly_wait_task(grouped);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	(void)errcode;
+	fly_destroy_task(after);
+	fly_destroy_task(grouped);
+	fly_destroy_task(queued);
+	fly_destroy_task_queue(queue);
+	fly_destroy_task_group(group);
+}
+
+static double get_thread_cpu_time_in_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (ts.tv_sec * 1000000.0) + (ts.tv_nsec / 1000.0);
+}
+
+static void hold_iteration(int index, void *ptr)
+{
+	held = 1;
+	while (!released)
+		usleep(1000);
+}
+
+static void *hold_func(void *param)
+{
+	int errcode = fly_parallel_for(1, hold_iteration, NULL);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_parallel_for failed");
+	(void)errcode;
+	return param;
+}
+
+static void *sleep_func(void *param)
+{
+	started = 1;
+	usleep(SLEEP_USEC);
+	return param;
+}
+
+static void *group_wait_func(void *param)
+{
+	double start = get_thread_cpu_time_in_usec();
+	int errcode = fly_group_wait((struct fly_task_group*)param);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_wait failed");
+	(void)errcode;
+	waitcpu = get_thread_cpu_time_in_usec() - start;
+	return param;
+}
+
+static void test_wait_sleeps()
+{
+	struct fly_task_group *group = fly_create_task_group();
+	struct fly_task *sleeper = fly_create_task(sleep_func, NULL);
+	struct fly_task *waiter = fly_create_task(group_wait_func, group);
+	pthread_t holder;
+	char buf[128];
+	int errcode;
+
+	errcode = fly_simple_init(NB_WORKERS);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+	held = 0;
+	released = 0;
+	started = 0;
+	pthread_create(&holder, NULL, hold_func, NULL);
+	while (!held)
+		usleep(1000);
+	errcode = fly_group_push_task(group, sleeper);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_group_push_task failed");
+	while (!started)
+		usleep(1000);
+	errcode = fly_push_task(waiter);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(waiter);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	released = 1;
+	pthread_join(holder, NULL);
+	sprintf(buf, "group wait CPU time:\t%f us", waitcpu);
+	fly_log("[test_task_group]", buf);
+	fly_assert(waitcpu < SLEEP_USEC / 4, "worker waiting for a group spins");
+	fly_destroy_task(waiter);
+	fly_destroy_task(sleeper);
+	fly_destroy_task_group(group);
+
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+}
+
+int main(int argc, char **argv)
+{
+	int errcode;
+	long nbcpus;
+	int i;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	for (i = 0; i < NB_TASKS; i++) {
+		tasks[i] = fly_create_task(count_func, &tasks[i]);
+		fly_assert(tasks[i], "fly_create_task failed");
+	}
+
+	test_group();
+	test_timed_wait();
+	test_cancel();
+	test_rejected();
+
+	for (i = 0; i < NB_TASKS; i++)
+		fly_destroy_task(tasks[i]);
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	test_wait_sleeps();
+
+	fly_log("[test_task_group]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,219 @@
+/******************************************************************************
+ * test_task_prio.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <unistd.h> /* for sysconf, usleep */
+
+/*
+ * A blocker task holds a thread of every worker while high and low priority
+ * tasks pile up in the ready queues. Once the blockers return, a low task may
+ * only start after all high ones were taken - the other threads can each hold
+ * one high task which did not start yet. With aging a low task which waited
+ * long enough is taken first instead - the thread which took it may be
+ * preempted before it starts, so only a loose bound is checked. The backup
+ * thread of a worker may still be free and take tasks while they are pushed,
+ * so the low task is pushed last for the strict case and the bounds count
+ * both threads.
+ * A low task is also queued while normal tasks sit on the deque of a worker.
+ * The other workers steal those first, only the threads which took the last
+ * normal tasks may not have started them when the low one runs.
+ */
+#define NB_HIGH			256
+#define NB_NORMAL		256
+#define AGING_US		1000
+#define SPIN_LOOP_SIZE	10000
+
+static volatile int gate;
+static volatile int blocked;
+static volatile int high_started;
+static int high_before_low;
+static volatile int normal_started;
+static int normal_before_low;
+
+static void *blocker_func(void *param)
+{
+	__sync_add_and_fetch(&blocked, 1);
+	while (!gate)
+		usleep(100);
+	return param;
+}
+
+static void *high_func(void *param)
+{
+	__sync_add_and_fetch(&high_started, 1);
+	return param;
+}
+
+static void *low_func(void *param)
+{
+	high_before_low = high_started;
+	return param;
+}
+
+static void *normal_func(void *param)
+{
+	volatile int i;
+	__sync_add_and_fetch(&normal_started, 1);
+	for (i = 0; i < SPIN_LOOP_SIZE; i++)
+		;
+	return param;
+}
+
+static void *low_after_normal_func(void *param)
+{
+	normal_before_low = normal_started;
+	return param;
+}
+
+/* tasks holds NB_NORMAL normal tasks and the low one */
+static void *pusher_func(void *param)
+{
+	struct fly_task **tasks = (struct fly_task**)param;
+	int errcode = FLYESUCCESS;
+	int i;
+	for (i = 0; (i < NB_NORMAL) && FLY_SUCCEEDED(errcode); i++)
+		errcode = fly_push_task(tasks[i]);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_push_task_prio(tasks[NB_NORMAL], FLY_PRIO_LOW);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task_prio failed");
+	errcode = fly_wait_tasks(tasks, NB_NORMAL + 1);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	(void)errcode;
+	return param;
+}
+
+static void run(long nbworkers, int aging)
+{
+	struct fly_config config;
+	struct fly_task *blockers[nbworkers];
+	struct fly_task *high[NB_HIGH];
+	struct fly_task *low;
+	int errcode;
+	int i;
+
+	fly_config_init(&config, nbworkers);
+	config.prio_aging_us = aging;
+	errcode = fly_init(&config);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_init failed");
+
+	gate = 0;
+	blocked = 0;
+	high_started = 0;
+	for (i = 0; i < nbworkers; i++) {
+		blockers[i] = fly_create_task(blocker_func, NULL);
+		errcode = fly_push_task(blockers[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	}
+	while (blocked < nbworkers)
+		usleep(100);
+
+	low = fly_create_task(low_func, NULL);
+	if (aging) {
+		errcode = fly_push_task_prio(low, FLY_PRIO_LOW);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task_prio failed");
+		usleep(2 * AGING_US);
+	}
+	for (i = 0; i < NB_HIGH; i++) {
+		high[i] = fly_create_task(high_func, NULL);
+		errcode = fly_push_task_prio(high[i], FLY_PRIO_HIGH);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task_prio failed");
+	}
+	if (!aging) {
+		errcode = fly_push_task_prio(low, FLY_PRIO_LOW);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task_prio failed");
+	}
+	gate = 1;
+
+	errcode = fly_wait_tasks(high, NB_HIGH);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	errcode = fly_wait_task(low);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	errcode = fly_wait_tasks(blockers, nbworkers);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_tasks failed");
+	if (aging) {
+		fly_assert(high_before_low < NB_HIGH / 2,
+				"aged low priority task did not go first");
+	} else {
+		fly_assert(high_before_low > NB_HIGH - 2 * nbworkers,
+				"low priority task ran before high priority ones");
+	}
+
+	errcode = fly_push_task_prio(low, FLY_PRIO_NB_LEVELS);
+	fly_assert(errcode == FLYEATTR, "invalid priority accepted");
+	for (i = 0; i < NB_HIGH; i++)
+		fly_destroy_task(high[i]);
+	for (i = 0; i < nbworkers; i++)
+		fly_destroy_task(blockers[i]);
+	fly_destroy_task(low);
+
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+}
+
+static void run_stealing(long nbworkers)
+{
+	struct fly_task *tasks[NB_NORMAL + 1];
+	struct fly_task *pusher;
+	int errcode;
+	int i;
+
+	errcode = fly_simple_init(nbworkers);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	normal_started = 0;
+	for (i = 0; i < NB_NORMAL; i++)
+		tasks[i] = fly_create_task(normal_func, NULL);
+	tasks[NB_NORMAL] = fly_create_task(low_after_normal_func, NULL);
+	pusher = fly_create_task(pusher_func, tasks);
+	errcode = fly_push_task(pusher);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_wait_task(pusher);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_task failed");
+	fly_assert(normal_before_low > NB_NORMAL - 2 * nbworkers,
+			"low priority task ran before stealing normal ones");
+
+	fly_destroy_task(pusher);
+	for (i = 0; i <= NB_NORMAL; i++)
+		fly_destroy_task(tasks[i]);
+
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+}
+
+int main(int argc, char **argv)
+{
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	run(nbcpus, 0);
+	run(nbcpus, AGING_US);
+	run_stealing(nbcpus);
+
+	fly_log("[test_task_prio]", "All tests pass!");
+
+	return 0;
+}
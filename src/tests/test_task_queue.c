@@ -0,0 +1,166 @@
+/******************************************************************************
+ * test_task_queue.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <unistd.h> /* for sysconf, usleep */
+
+/*
+ * A gated task only completes once the test opens its gate, so whatever
+ * completes before it has to come out of fly_wait_any and the queue first.
+ * It waits in a blocking region, the other tasks run on the backup thread of
+ * its worker when there is only one.
+ */
+#define NB_TASKS		64
+#define SPIN_LOOP_SIZE	10000
+
+static volatile int gate;
+static volatile int ran[NB_TASKS];
+int indexes[NB_TASKS];
+
+static void *gated_func(void *param)
+{
+	fly_blocking_begin();
+	while (!gate)
+		usleep(100);
+	fly_blocking_end();
+	return param;
+}
+
+static void *short_func(void *param)
+{
+	volatile int i;
+	for (i = 0; i < SPIN_LOOP_SIZE; i++)
+		;
+	ran[*(int*)param]++;
+	return param;
+}
+
+static void test_wait_any()
+{
+	struct fly_task *tasks[2];
+	int index = -1;
+	int errcode;
+	gate = 0;
+	indexes[0] = 0;
+	tasks[0] = fly_create_task(gated_func, NULL);
+	tasks[1] = fly_create_task(short_func, &indexes[0]);
+	fly_assert(tasks[0] && tasks[1], "fly_create_task failed");
+	fly_assert(fly_task_is_done(tasks[0]), "unpushed task is not done");
+	errcode = fly_push_task(tasks[0]);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	errcode = fly_push_task(tasks[1]);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+
+	errcode = fly_wait_any(tasks, 2, &index);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_any failed");
+	fly_assert(index == 1, "fly_wait_any gave a task which did not complete");
+	fly_assert(!fly_task_is_done(tasks[0]), "gated task done");
+
+	gate = 1;
+	errcode = fly_wait_any(tasks, 2, &index);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_wait_any failed");
+	fly_assert(index == 0, "fly_wait_any gave a waited task");
+	errcode = fly_wait_any(tasks, 2, &index);
+	fly_assert(errcode == FLYEATTR, "fly_wait_any without outstanding tasks");
+	(void)errcode;
+	fly_destroy_task(tasks[0]);
+	fly_destroy_task(tasks[1]);
+}
+
+static void test_queue()
+{
+	struct fly_task_queue *queue = fly_create_task_queue();
+	struct fly_task *gated;
+	struct fly_task *tasks[NB_TASKS];
+	struct fly_task *task;
+	int errcode;
+	int i;
+	fly_assert(queue, "fly_create_task_queue failed");
+	fly_assert(fly_task_queue_poll(queue) == NULL, "poll of an empty queue");
+	fly_assert(fly_task_queue_wait(queue) == NULL, "wait on an empty queue");
+
+	gate = 0;
+	gated = fly_create_task(gated_func, NULL);
+	fly_task_set_queue(gated, queue);
+	errcode = fly_push_task(gated);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	for (i = 0; i < NB_TASKS; i++) {
+		indexes[i] = i;
+		ran[i] = 0;
+		tasks[i] = fly_create_task(short_func, &indexes[i]);
+		fly_task_set_queue(tasks[i], queue);
+		errcode = fly_push_task(tasks[i]);
+		fly_assert(FLY_SUCCEEDED(errcode), "fly_push_task failed");
+	}
+
+	for (i = 0; i < NB_TASKS; i++) {
+		task = (i % 2) ? fly_task_queue_wait(queue) :
+			fly_task_queue_poll(queue);
+		if (!task) {
+			i--;
+			continue;
+		}
+		fly_assert(task != gated, "gated task came out before it completed");
+		fly_assert(fly_task_is_done(task), "queued task is not done");
+		fly_assert(ran[*(int*)fly_get_task_result(task)] == 1,
+				"task came out of the queue twice");
+		ran[*(int*)fly_get_task_result(task)]++;
+	}
+	fly_assert(fly_task_queue_poll(queue) == NULL, "gated task came out");
+
+	gate = 1;
+	task = fly_task_queue_wait(queue);
+	fly_assert(task == gated, "gated task did not come out last");
+	fly_assert(fly_task_queue_wait(queue) == NULL, "drained queue not empty");
+	(void)task;
+	(void)errcode;
+
+	for (i = 0; i < NB_TASKS; i++)
+		fly_destroy_task(tasks[i]);
+	fly_destroy_task(gated);
+	fly_destroy_task_queue(queue);
+}
+
+int main(int argc, char **argv)
+{
+	int errcode;
+	long nbcpus;
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	test_wait_any();
+	test_queue();
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	fly_log("[test_task_queue]", "All tests pass!");
+
+	return 0;
+}
@@ -0,0 +1,173 @@
+/******************************************************************************
+ * test_task_scaling.c
+ *
+ * Copyright (C) 2013 Kostadin Atanasov <pranayama111@gmail.com>
+ *
+ * This file is part of libfly.
+ *
+ * libfly is free software: you can redistribute it and/or modify
+ * if under the terms of GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libfly is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should received a copy of the GNU Lesser General Public License
+ * along with libfly. If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#include <libfly/fly.h>
+
+#include <stdio.h> /* for sprintf */
+#include <stdlib.h> /* for malloc */
+#include <unistd.h> /* for sysconf */
+
+/******************************************************************************
+ * Profiling stuff
+ *****************************************************************************/
+#include <sys/time.h>
+static inline double get_time_in_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+static inline double get_time_diff_in_usec(double prevtime)
+{
+	double nowtime = get_time_in_usec();
+	return nowtime - prevtime;
+}
+/******************************************************************************
+ * End of profiling stuff
+ *****************************************************************************/
+
+/*
+ * The time per task should stay the same while the number of tasks in flight
+ * grows. FLY_MEMDEBUG tracks every allocation in an array, which is linear by
+ * itself, so the memory debug builds stop earlier.
+ */
+#define MIN_NBTASKS		(1 << 10)
+#ifdef FLY_MEMDEBUG
+#define MAX_NBTASKS		(1 << 12)
+#else
+#define MAX_NBTASKS		(1 << 20)
+#endif
+
+static int *hits;
+
+static void *task_func(void *param)
+{
+	__sync_add_and_fetch(&hits[(long)param], 1);
+	return param;
+}
+
+static void clean_tasks(struct fly_task **tasks, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		fly_destroy_task(tasks[i]);
+}
+
+static int validate_hits(int count)
+{
+	int i;
+	int err = 0;
+	for (i = 0; i < count; i++) {
+		if (hits[i] != 1) {
+			char msg[256] = {0};
+			sprintf(msg, "task %d executed %d times", i, hits[i]);
+			fly_log("[test_task_scaling]", msg);
+			err = 1;
+		}
+	}
+	return !err;
+}
+
+static int run_tasks(struct fly_task **tasks, int count)
+{
+	int errcode = FLYESUCCESS;
+	int valid;
+	int i;
+	double timestart;
+	double timedelta;
+	char msg[256];
+
+	for (i = 0; i < count; i++)
+		hits[i] = 0;
+
+	timestart = get_time_in_usec();
+	for (i = 0; i < count; i++) {
+		tasks[i] = fly_create_task(task_func, (void*)(long)i);
+		if (!tasks[i]) {
+			clean_tasks(tasks, i);
+			return FLYENORES;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		errcode = fly_push_task(tasks[i]);
+		if (!FLY_SUCCEEDED(errcode)) {
+			fly_wait_tasks(tasks, i);
+			clean_tasks(tasks, count);
+			return errcode;
+		}
+	}
+	/* newest first - the last jobs to finish are collected first */
+	for (i = count - 1; i >= 0; i--) {
+		int tmp = fly_wait_task(tasks[i]);
+		if (!FLY_SUCCEEDED(tmp))
+			errcode = tmp;
+	}
+	clean_tasks(tasks, count);
+	timedelta = get_time_diff_in_usec(timestart);
+
+	sprintf(msg, "%8d tasks took: %12f us; per task: %f us",
+			count, timedelta, timedelta / count);
+	fly_log("[test_task_scaling]", msg);
+	valid = validate_hits(count);
+	(void)valid;
+	fly_assert(valid, "tasks not executed exactly once");
+	return errcode;
+}
+
+int main(int argc, char **argv)
+{
+	int					errcode;
+	long				nbcpus;
+	int					count;
+	struct fly_task		**tasks;
+
+	tasks = malloc(MAX_NBTASKS * sizeof(struct fly_task*));
+	hits = malloc(MAX_NBTASKS * sizeof(int));
+	if (!tasks || !hits) {
+		fly_assert(0, "test_task_scaling out of memory");
+		return -1;
+	}
+
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbcpus < 0)
+		nbcpus = 2; /* hardcode to some multithread value... */
+
+	errcode = fly_simple_init(nbcpus);
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_simple_init failed");
+
+	for (count = MIN_NBTASKS; count <= MAX_NBTASKS; count *= 4) {
+		errcode = run_tasks(tasks, count);
+		fly_assert(FLY_SUCCEEDED(errcode), "run_tasks failed");
+	}
+
+	/* shutdown libfly */
+	errcode = fly_uninit();
+	(void)errcode;
+	fly_assert(FLY_SUCCEEDED(errcode), "fly_uninit failed");
+
+	free(tasks);
+	free(hits);
+
+	fly_log("[test_task_scaling]", "All tests pass!");
+
+	return 0;
+}